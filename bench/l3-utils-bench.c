@@ -0,0 +1,330 @@
+/*
+ Copyright (C) 2016 Hewlett-Packard Development Company, L.P.
+ All Rights Reserved.
+
+    Licensed under the Apache License, Version 2.0 (the "License"); you may
+    not use this file except in compliance with the License. You may obtain
+    a copy of the License at
+
+         http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+    WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+    License for the specific language governing permissions and limitations
+    under the License.
+*/
+
+/*************************************************************************//**
+ * @ingroup l3_utils
+ * Benchmark for the l3-utils overlap checks.
+ *
+ * Builds synthetic VRF rows in memory, so no ovsdb-server is needed, and
+ * measures the latency percentiles and throughput of
+ * l3_utils_is_ipaddr_overlapping() and of the Bloom filter prefilter.
+ *
+ * Usage: l3-utils-bench [queries-per-run]
+ *
+ * @file
+ * Source file for the l3-utils benchmark.
+ *
+ ****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <inttypes.h>
+#include <arpa/inet.h>
+
+#include "util.h"
+#include "uuid.h"
+#include "vswitch-idl.h"
+#include "l3-utils.h"
+
+#define BENCH_DEFAULT_QUERIES    20000
+#define BENCH_MAX_SECONDARIES    32
+#define BENCH_IF_NAME            "bench"
+
+/* VRF sizes to benchmark, in ports */
+static const size_t bench_vrf_sizes[] = { 64, 1024, 4096 };
+
+/* Query mix of one benchmark run */
+enum bench_query_type {
+    BENCH_QUERY_NEW,             /* Address not configured anywhere */
+    BENCH_QUERY_EXISTING,        /* Address inside a configured subnet */
+    BENCH_QUERY_MAX
+};
+
+static const char *bench_query_names[BENCH_QUERY_MAX] = {
+    "new", "existing"
+};
+
+struct bench_query {
+    char *address;
+    u_char family;
+};
+
+/*
+ * Returns the address string of the n-th synthetic subnet. IPv4 subnets
+ * are consecutive /30s in 10.0.0.0/8, IPv6 subnets are /64s in
+ * 2001:db8::/32.
+ */
+static char *
+bench_subnet_address (unsigned int n, u_char family, bool host)
+{
+    uint32_t addr;
+
+    if (family == AF_INET) {
+        addr = (10u << 24) + (n << 2) + 1;
+        return xasprintf("%u.%u.%u.%u/%u", addr >> 24, (addr >> 16) & 0xff,
+                         (addr >> 8) & 0xff, addr & 0xff, host ? 32 : 30);
+    }
+    return xasprintf("2001:db8:%x:%x::1/%u", n >> 16, n & 0xffff,
+                     host ? 128 : 64);
+}
+
+/*
+ * Builds a VRF with n_ports ports. Every port has an IPv4 and an IPv6
+ * primary address and 0 to BENCH_MAX_SECONDARIES secondaries of each
+ * family. Returns the number of subnets allocated in *n_subnets.
+ */
+static struct ovsrec_vrf *
+bench_vrf_create (size_t n_ports, unsigned int *n_subnets)
+{
+    struct ovsrec_vrf *vrf_row;
+    struct ovsrec_port *port_row;
+    unsigned int subnet = 0;
+    size_t i, j, n_secondary;
+
+    vrf_row = xzalloc(sizeof *vrf_row);
+    uuid_generate(&vrf_row->header_.uuid);     /* Keys the filter cache */
+    vrf_row->name = xstrdup("bench");
+    vrf_row->ports = xcalloc(n_ports, sizeof *vrf_row->ports);
+    vrf_row->n_ports = n_ports;
+
+    for (i = 0; i < n_ports; i++) {
+        port_row = xzalloc(sizeof *port_row);
+        port_row->name = xasprintf("1/1/%"PRIuSIZE, i + 1);
+        port_row->ip4_address = bench_subnet_address(subnet++, AF_INET,
+                                                     false);
+        port_row->ip6_address = bench_subnet_address(subnet++, AF_INET6,
+                                                     false);
+
+        n_secondary = random() % (BENCH_MAX_SECONDARIES + 1);
+        port_row->ip4_address_secondary =
+            xcalloc(n_secondary, sizeof *port_row->ip4_address_secondary);
+        port_row->ip6_address_secondary =
+            xcalloc(n_secondary, sizeof *port_row->ip6_address_secondary);
+        for (j = 0; j < n_secondary; j++) {
+            port_row->ip4_address_secondary[j] =
+                bench_subnet_address(subnet++, AF_INET, false);
+            port_row->ip6_address_secondary[j] =
+                bench_subnet_address(subnet++, AF_INET6, false);
+        }
+        port_row->n_ip4_address_secondary = n_secondary;
+        port_row->n_ip6_address_secondary = n_secondary;
+
+        vrf_row->ports[i] = port_row;
+    }
+    *n_subnets = subnet;
+    return vrf_row;
+}
+
+static void
+bench_vrf_destroy (struct ovsrec_vrf *vrf_row)
+{
+    struct ovsrec_port *port_row;
+    size_t i, j;
+
+    for (i = 0; i < vrf_row->n_ports; i++) {
+        port_row = vrf_row->ports[i];
+        for (j = 0; j < port_row->n_ip4_address_secondary; j++) {
+            free(port_row->ip4_address_secondary[j]);
+            free(port_row->ip6_address_secondary[j]);
+        }
+        free(port_row->ip4_address_secondary);
+        free(port_row->ip6_address_secondary);
+        free(port_row->ip4_address);
+        free(port_row->ip6_address);
+        free(port_row->name);
+        free(port_row);
+    }
+    free(vrf_row->ports);
+    free(vrf_row->name);
+    free(vrf_row);
+}
+
+/*
+ * Generates n host address queries with a 50/50 IPv4/IPv6 mix. New
+ * addresses are taken from subnets past the last configured one.
+ */
+static struct bench_query *
+bench_queries_create (size_t n, enum bench_query_type type,
+                      unsigned int n_subnets)
+{
+    struct bench_query *queries = xmalloc(n * sizeof *queries);
+    unsigned int subnet;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        queries[i].family = (i & 1) ? AF_INET6 : AF_INET;
+        if (type == BENCH_QUERY_NEW) {
+            subnet = n_subnets + random() % n_subnets;
+        }
+        else {
+            subnet = random() % n_subnets;
+        }
+        /* Even subnets are IPv4, odd subnets are IPv6 */
+        subnet = (subnet & ~1u) | (queries[i].family == AF_INET6);
+        queries[i].address = bench_subnet_address(subnet, queries[i].family,
+                                                  true);
+    }
+    return queries;
+}
+
+static void
+bench_queries_destroy (struct bench_query *queries, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        free(queries[i].address);
+    }
+    free(queries);
+}
+
+static inline uint64_t
+bench_now_ns (void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int
+bench_cmp_u64 (const void *a_, const void *b_)
+{
+    uint64_t a = *(const uint64_t *) a_;
+    uint64_t b = *(const uint64_t *) b_;
+
+    return a < b ? -1 : a > b;
+}
+
+/* Sorts the samples and prints one result line */
+static void
+bench_report (const char *name, size_t n_ports, const char *query_name,
+              uint64_t *samples, size_t n, uint64_t total_ns, size_t hits)
+{
+    qsort(samples, n, sizeof *samples, bench_cmp_u64);
+    printf("%-10s %6"PRIuSIZE" %-9s %10"PRIu64" %10"PRIu64" %10"PRIu64
+           " %10"PRIu64" %12.0f %7.3f\n",
+           name, n_ports, query_name,
+           samples[n / 2], samples[n * 90 / 100], samples[n * 99 / 100],
+           samples[n - 1], n * 1e9 / total_ns, (double) hits / n);
+}
+
+/* Measures l3_utils_is_ipaddr_overlapping(), which builds the VRF's cached
+ * filter on its first call */
+static void
+bench_run_overlap (const struct ovsrec_vrf *vrf_row,
+                   const struct bench_query *queries, size_t n,
+                   const char *query_name, uint64_t *samples)
+{
+    uint64_t start, end, total = 0;
+    size_t i, hits = 0;
+
+    for (i = 0; i < n; i++) {
+        start = bench_now_ns();
+        hits += l3_utils_is_ipaddr_overlapping(queries[i].address,
+                                               BENCH_IF_NAME,
+                                               queries[i].family, false,
+                                               vrf_row);
+        end = bench_now_ns();
+        samples[i] = end - start;
+        total += end - start;
+    }
+    bench_report("overlap", vrf_row->n_ports, query_name, samples, n,
+                 total, hits);
+}
+
+/* Measures the Bloom filter prefilter followed by the exact check */
+static void
+bench_run_filtered (const struct ovsrec_vrf *vrf_row,
+                    const struct l3_utils_addr_filter *filter,
+                    const struct bench_query *queries, size_t n,
+                    const char *query_name, uint64_t *samples)
+{
+    struct l3_utils_prefix prefix;
+    uint64_t start, end, total = 0;
+    size_t i, hits = 0;
+
+    for (i = 0; i < n; i++) {
+        start = bench_now_ns();
+        if (l3_utils_parse_prefix(queries[i].address, queries[i].family,
+                                  &prefix) &&
+            l3_utils_addr_filter_may_overlap(filter, &prefix)) {
+            hits += l3_utils_is_ipaddr_overlapping(queries[i].address,
+                                                   BENCH_IF_NAME,
+                                                   queries[i].family, false,
+                                                   vrf_row);
+        }
+        end = bench_now_ns();
+        samples[i] = end - start;
+        total += end - start;
+    }
+    bench_report("filtered", vrf_row->n_ports, query_name, samples, n,
+                 total, hits);
+}
+
+int
+main (int argc, char *argv[])
+{
+    struct ovsrec_vrf *vrf_row;
+    struct l3_utils_addr_filter *filter;
+    struct l3_utils_prefix *prefixes;
+    struct bench_query *queries;
+    uint64_t *samples;
+    unsigned int n_subnets;
+    size_t n_queries = BENCH_DEFAULT_QUERIES;
+    size_t i, n_prefixes;
+    int type;
+
+    if (argc > 1) {
+        n_queries = strtoul(argv[1], NULL, 10);
+        if (n_queries == 0) {
+            fprintf(stderr, "usage: %s [queries-per-run]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    srandom(1);
+    samples = xmalloc(n_queries * sizeof *samples);
+
+    printf("%-10s %6s %-9s %10s %10s %10s %10s %12s %7s\n",
+           "check", "ports", "queries", "p50(ns)", "p90(ns)", "p99(ns)",
+           "max(ns)", "calls/s", "hits");
+
+    for (i = 0; i < ARRAY_SIZE(bench_vrf_sizes); i++) {
+        vrf_row = bench_vrf_create(bench_vrf_sizes[i], &n_subnets);
+        n_prefixes = l3_utils_vrf_get_prefixes(vrf_row, AF_UNSPEC, &prefixes);
+        filter = l3_utils_addr_filter_create(prefixes, n_prefixes);
+        free(prefixes);
+
+        for (type = 0; type < BENCH_QUERY_MAX; type++) {
+            queries = bench_queries_create(n_queries, type, n_subnets);
+            bench_run_overlap(vrf_row, queries, n_queries,
+                              bench_query_names[type], samples);
+            bench_run_filtered(vrf_row, filter, queries, n_queries,
+                               bench_query_names[type], samples);
+            bench_queries_destroy(queries, n_queries);
+        }
+
+        l3_utils_addr_filter_destroy(filter);
+        bench_vrf_destroy(vrf_row);
+    }
+
+    free(samples);
+    return 0;
+}
@@ -34,6 +34,10 @@
 #ifndef __L3_UTILS_H_
 #define __L3_UTILS_H_
 
+#include <stdbool.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+
 /* IP_ADDRESS is of format xxx.xxx.xxx.xxx/MM and max length 18*/
 #define IP_ADDRESS_LENGTH              18
 /* IPV6_ADDRESS is of format xxxx:xxxx:xxxx:xxxx:xxxx:xxxx:AAA.BBB.CCC.DDD/MMM
@@ -45,9 +49,27 @@
 #define IPV4_BITLENGTH_MAX             32
 #define IPV6_BITLENGTH_MAX             128
 
+struct ovsdb_idl;
+struct ovsrec_vrf;
+struct l3_utils_subnet_pool;
+struct l3_utils_addr_filter;
+
+/* Binary form of an IPv4/IPv6 address together with its prefix length */
+struct l3_utils_prefix {
+    u_char family;                /* AF_INET, AF_INET6 or AF_UNSPEC */
+    u_char prefix_len;            /* Number of network bits */
+    union {
+        struct in_addr ipv4;      /* Network byte order */
+        struct in6_addr ipv6;     /* Network byte order */
+    } addr;
+};
+
 /************************************************************************//**
  * Checks if IPv4 or IPv6 address already configured or not.
  *
+ * Addresses that overlap nothing are answered from the VRF's cached
+ * filter, see l3_utils_addr_filter_get(), so this is not thread safe.
+ *
  * @param[in]  ip_address: User configured ip address
  * @param[in]  if_name   : Interface for which user is configuring IP
  * @param[in]  ipv6      : 1 indicates IPv6 address, 0 IPv4 address
@@ -64,6 +86,217 @@ l3_utils_is_ipaddr_overlapping (const char *ip_address,
                                 bool secondary,
                                 const struct ovsrec_vrf *vrf_row);
 
+/************************************************************************//**
+ * Parses an IPv4 "a.b.c.d[/len]" or IPv6 "x:x::x[/len]" string into its
+ * binary form in a single pass, without copying the input. The address
+ * bits are stored as given (host bits are not cleared). If the prefix
+ * length is omitted, a host prefix (/32 or /128) is assumed.
+ *
+ * @param[in]  str       : Address string to parse
+ * @param[in]  family    : AF_INET, AF_INET6, or AF_UNSPEC to accept either
+ * @param[out] prefix    : Parsed address and prefix length. On failure the
+ *                         family is set to AF_UNSPEC.
+ *
+ * @return true if str is a valid address of the requested family with a
+ *         prefix length in range, else false.
+ ***************************************************************************/
+extern bool
+l3_utils_parse_prefix (const char *str, u_char family,
+                       struct l3_utils_prefix *prefix);
+
+/************************************************************************//**
+ * Batch version of l3_utils_parse_prefix(). Parses n strings into the
+ * prefixes array; entries that fail to parse have their family set to
+ * AF_UNSPEC.
+ *
+ * @param[in]  strs      : Array of n address strings
+ * @param[in]  n         : Number of strings to parse
+ * @param[in]  family    : AF_INET, AF_INET6, or AF_UNSPEC to accept either
+ * @param[out] prefixes  : Array of n parsed prefixes
+ *
+ * @return number of strings that were parsed successfully.
+ ***************************************************************************/
+extern size_t
+l3_utils_parse_prefixes (const char *const *strs, size_t n, u_char family,
+                         struct l3_utils_prefix *prefixes);
+
+/************************************************************************//**
+ * Replaces an array of prefixes with the minimal set of prefixes that
+ * covers exactly the same address space. Host bits are cleared, then
+ * contained prefixes are dropped and adjacent sibling prefixes are merged
+ * into their parent. The result is sorted by family, address and length.
+ * Runs in O(n log n).
+ *
+ * @param[in,out] prefixes : Array of prefixes, aggregated in place
+ * @param[in]     n        : Number of prefixes in the array
+ *
+ * @return number of prefixes left at the front of the array.
+ ***************************************************************************/
+extern size_t
+l3_utils_aggregate_prefixes (struct l3_utils_prefix *prefixes, size_t n);
+
+/************************************************************************//**
+ * Collects the connected subnets (primary and secondary addresses with
+ * host bits cleared) of every port in a VRF.
+ *
+ * @param[in]  vrf_row   : VRF row whose ports are collected
+ * @param[in]  family    : AF_INET, AF_INET6, or AF_UNSPEC for both
+ * @param[out] prefixes  : Newly allocated array of subnets. The caller
+ *                         must free it.
+ *
+ * @return number of subnets in the array.
+ ***************************************************************************/
+extern size_t
+l3_utils_vrf_get_prefixes (const struct ovsrec_vrf *vrf_row, u_char family,
+                           struct l3_utils_prefix **prefixes);
+
+/************************************************************************//**
+ * Returns the minimal covering set of a VRF's connected subnets, as
+ * l3_utils_vrf_get_prefixes() followed by l3_utils_aggregate_prefixes().
+ *
+ * @param[in]  vrf_row   : VRF row whose ports are collected
+ * @param[in]  family    : AF_INET, AF_INET6, or AF_UNSPEC for both
+ * @param[out] prefixes  : Newly allocated array of aggregated prefixes.
+ *                         The caller must free it.
+ *
+ * @return number of aggregated prefixes in the array.
+ ***************************************************************************/
+extern size_t
+l3_utils_vrf_aggregate_prefixes (const struct ovsrec_vrf *vrf_row,
+                                 u_char family,
+                                 struct l3_utils_prefix **prefixes);
+
+/************************************************************************//**
+ * Creates an allocator that carves subnets out of pool without overlapping
+ * any primary or secondary address configured on the ports of a VRF. The
+ * VRF's occupied address space is indexed once, so allocating many
+ * subnets costs O(ports log ports + allocations).
+ *
+ * @param[in]  vrf_row   : VRF row whose port addresses are in use
+ * @param[in]  pool      : IPv4 or IPv6 subnet to allocate from
+ *
+ * @return allocator, or NULL if pool is not an IPv4/IPv6 prefix. Free it
+ *         with l3_utils_subnet_pool_destroy().
+ ***************************************************************************/
+extern struct l3_utils_subnet_pool *
+l3_utils_subnet_pool_create (const struct ovsrec_vrf *vrf_row,
+                             const struct l3_utils_prefix *pool);
+
+/************************************************************************//**
+ * Allocates the next free subnets of the requested length from the pool.
+ * Subnets are handed out in ascending address order and are never handed
+ * out twice by the same allocator.
+ *
+ * @param[in]  subnet_pool : Allocator
+ * @param[in]  prefix_len  : Length of the subnets to allocate, e.g. 31,
+ *                           30 or 127
+ * @param[in]  count       : Maximum number of subnets to allocate
+ * @param[out] subnets     : Array of at least count allocated subnets
+ *
+ * @return number of subnets allocated, less than count if the pool ran
+ *         out of free space.
+ ***************************************************************************/
+extern size_t
+l3_utils_subnet_pool_alloc (struct l3_utils_subnet_pool *subnet_pool,
+                            unsigned int prefix_len, size_t count,
+                            struct l3_utils_prefix *subnets);
+
+/************************************************************************//**
+ * Frees an allocator created by l3_utils_subnet_pool_create().
+ *
+ * @param[in]  subnet_pool : Allocator, may be NULL
+ ***************************************************************************/
+extern void
+l3_utils_subnet_pool_destroy (struct l3_utils_subnet_pool *subnet_pool);
+
+/************************************************************************//**
+ * Returns the first free subnets of the requested length in pool that do
+ * not overlap any address configured on the ports of a VRF.
+ *
+ * @param[in]  vrf_row     : VRF row whose port addresses are in use
+ * @param[in]  pool        : IPv4 or IPv6 subnet to allocate from
+ * @param[in]  prefix_len  : Length of the subnets to return
+ * @param[in]  count       : Maximum number of subnets to return
+ * @param[out] subnets     : Array of at least count free subnets
+ *
+ * @return number of free subnets found.
+ ***************************************************************************/
+extern size_t
+l3_utils_find_free_subnets (const struct ovsrec_vrf *vrf_row,
+                            const struct l3_utils_prefix *pool,
+                            unsigned int prefix_len, size_t count,
+                            struct l3_utils_prefix *subnets);
+
+/************************************************************************//**
+ * Creates a Bloom filter over an array of prefixes. The filter answers
+ * "may this address overlap one of the prefixes" with no false negatives
+ * and a small false positive rate, touching a few cache lines per query.
+ *
+ * @param[in]  prefixes  : Array of IPv4/IPv6 prefixes to hold
+ * @param[in]  n         : Number of prefixes
+ *
+ * @return filter, to be freed with l3_utils_addr_filter_destroy().
+ ***************************************************************************/
+extern struct l3_utils_addr_filter *
+l3_utils_addr_filter_create (const struct l3_utils_prefix *prefixes,
+                             size_t n);
+
+/************************************************************************//**
+ * Frees a filter created by l3_utils_addr_filter_create().
+ *
+ * @param[in]  filter    : Filter, may be NULL
+ ***************************************************************************/
+extern void
+l3_utils_addr_filter_destroy (struct l3_utils_addr_filter *filter);
+
+/************************************************************************//**
+ * Checks if a prefix may overlap any prefix held by the filter, using the
+ * same overlap rule as l3_utils_is_ipaddr_overlapping().
+ *
+ * @param[in]  filter    : Filter to query
+ * @param[in]  prefix    : Prefix to look up
+ *
+ * @return false if prefix definitely does not overlap, true if it may.
+ ***************************************************************************/
+extern bool
+l3_utils_addr_filter_may_overlap (const struct l3_utils_addr_filter *filter,
+                                  const struct l3_utils_prefix *prefix);
+
+/************************************************************************//**
+ * Returns the filter over the port addresses of a VRF, or of all VRFs.
+ * Filters are cached. A VRF's filter is rebuilt lazily once its row or
+ * one of its Port rows changed, and on every call while they have changes
+ * in the caller's open transaction. The filter of all VRFs is rebuilt once
+ * the Port or VRF table changed, and does not see uncommitted changes.
+ * The returned filter is owned by the cache and is only valid until the
+ * next call. The cache is not thread safe.
+ *
+ * @param[in]  idl       : idl reference to OVSDB
+ * @param[in]  vrf_row   : VRF row, or NULL for all VRFs
+ *
+ * @return filter for the VRF.
+ ***************************************************************************/
+extern const struct l3_utils_addr_filter *
+l3_utils_addr_filter_get (const struct ovsdb_idl *idl,
+                          const struct ovsrec_vrf *vrf_row);
+
+/************************************************************************//**
+ * Prefilter for l3_utils_is_ipaddr_overlapping(). Callers only need to run
+ * the exact check if this returns true.
+ *
+ * @param[in]  idl         : idl reference to OVSDB
+ * @param[in]  ip_address  : User configured ip address
+ * @param[in]  addr_family : AF_INET or AF_INET6
+ * @param[in]  vrf_row     : VRF row, or NULL to check all VRFs
+ *
+ * @return false if ip_address definitely does not overlap any configured
+ *         address, true if it may.
+ ***************************************************************************/
+extern bool
+l3_utils_ipaddr_may_overlap (const struct ovsdb_idl *idl,
+                             const char *ip_address, u_char addr_family,
+                             const struct ovsrec_vrf *vrf_row);
+
 #endif /* __L3_UTILS_H_ */
 /** @} end of group l3_utils_public */
 /** @} end of group l3_utils */
@@ -0,0 +1,456 @@
+/*
+ Copyright (C) 2016 Hewlett-Packard Development Company, L.P.
+ All Rights Reserved.
+
+    Licensed under the Apache License, Version 2.0 (the "License"); you may
+    not use this file except in compliance with the License. You may obtain
+    a copy of the License at
+
+         http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+    WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+    License for the specific language governing permissions and limitations
+    under the License.
+*/
+
+/************************************************************************//**
+ * @defgroup mac_utils Core Utilities
+ * This library provides common utility functions used by various OpenSwitch
+ * processes.
+ * @{
+ *
+ * @defgroup mac_utils_public Public Interface
+ * Public API for mac_utils library.
+ *
+ * Indexes and containers over the MAC table and MAC addresses.
+ *
+ * @{
+ *
+ * @file
+ * Header for mac_utils library.
+ ***************************************************************************/
+
+#ifndef __MAC_UTILS_H_
+#define __MAC_UTILS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct ovsdb_idl;
+struct ovsrec_mac;
+struct ether_addr;
+struct mac_index_chunk;
+
+/************************************************************************//**
+ * Brings the MAC by VLAN view up to date with the MAC table.
+ *
+ * The view groups MAC rows by VLAN id, with the rows of each VLAN stored
+ * contiguously. It is built with a counting sort over the MAC table. When
+ * MACs are learned, aged out or move VLAN, only the rows that IDL change
+ * tracking reports are moved between buckets; if the MAC table changed
+ * without a tracked row to show for it, the view is sorted again. Tracking
+ * the MAC table therefore saves a sort per learning burst but is not needed
+ * for correct results.
+ *
+ * @param[in]  idl : pointer to ovsdb handler
+ ***************************************************************************/
+extern void ops_mac_vlan_view_run(struct ovsdb_idl *idl);
+
+/************************************************************************//**
+ * Drops the MAC by VLAN view, so that the next query rebuilds it from a
+ * full scan of the MAC table. Only needed after changing MAC rows in an
+ * uncommitted transaction.
+ ***************************************************************************/
+extern void ops_mac_vlan_view_invalidate(void);
+
+/************************************************************************//**
+ * Counts the MAC rows learned or configured on a VLAN.
+ *
+ * @param[in]  vlan_id : VLAN id, 0 for MACs without a VLAN
+ * @param[in]  idl     : pointer to ovsdb handler
+ *
+ * @return number of MAC rows whose mac_vlan is vlan_id
+ ***************************************************************************/
+extern size_t ops_mac_vlan_get_count(int vlan_id, struct ovsdb_idl *idl);
+
+/************************************************************************//**
+ * Gets the MAC rows of a VLAN as a contiguous array, in no particular
+ * order.
+ *
+ * @param[in]  vlan_id : VLAN id, 0 for MACs without a VLAN
+ * @param[in]  idl     : pointer to ovsdb handler
+ * @param[out] n       : number of rows in the returned array
+ *
+ * @return array of MAC rows, valid until the next call to ovsdb_idl_run,
+ *         or NULL if there are none
+ ***************************************************************************/
+extern const struct ovsrec_mac *const *
+ops_mac_vlan_get_rows(int vlan_id, struct ovsdb_idl *idl, size_t *n);
+
+/* Packs a VLAN id and a 48-bit MAC into a MAC table key */
+#define OPS_MAC_KEY(VLAN, MAC) \
+    (((uint64_t) (VLAN) << 48) | ((uint64_t) (MAC) & 0xffffffffffffULL))
+#define OPS_MAC_KEY_VLAN(KEY)  ((int) ((KEY) >> 48))
+#define OPS_MAC_KEY_MAC(KEY)   ((KEY) & 0xffffffffffffULL)
+
+/* Key and value stored inline in a MAC table */
+struct ops_mac_table_slot {
+    uint64_t key;                      /* OPS_MAC_KEY(vlan, mac) */
+    void *data;
+};
+
+/*
+ * Open addressing hash map from packed MAC+VLAN keys to pointers. Slots are
+ * probed 16 at a time through one control byte per slot holding 7 bits of
+ * the key's hash, compared with SSE2 where available. Initialize with
+ * ops_mac_table_init, the members are private.
+ */
+struct ops_mac_table {
+    uint8_t *ctrl;                     /* One control byte per slot */
+    struct ops_mac_table_slot *slots;
+    size_t capacity;                   /* Power of 2, 0 when empty */
+    size_t n;                          /* Keys present */
+    size_t n_deleted;                  /* Tombstones */
+};
+
+/* Iterates SLOT over the key/value pairs of TABLE, in no particular order.
+ * The table must not be modified during iteration. */
+#define OPS_MAC_TABLE_FOR_EACH(SLOT, TABLE)                             \
+    for (size_t slot_idx__ = ops_mac_table_next(TABLE, 0);              \
+         (slot_idx__ < (TABLE)->capacity                                \
+          ? ((SLOT) = &(TABLE)->slots[slot_idx__], true) : false);      \
+         slot_idx__ = ops_mac_table_next(TABLE, slot_idx__ + 1))
+
+/************************************************************************//**
+ * Initializes an empty MAC table.
+ ***************************************************************************/
+extern void ops_mac_table_init(struct ops_mac_table *table);
+
+/************************************************************************//**
+ * Frees the memory of a MAC table. The data pointers are not freed.
+ ***************************************************************************/
+extern void ops_mac_table_destroy(struct ops_mac_table *table);
+
+/************************************************************************//**
+ * Sizes a MAC table to hold at least n keys without growing.
+ ***************************************************************************/
+extern void ops_mac_table_reserve(struct ops_mac_table *table, size_t n);
+
+/************************************************************************//**
+ * Counts the keys in a MAC table.
+ ***************************************************************************/
+static inline size_t
+ops_mac_table_count(const struct ops_mac_table *table)
+{
+    return table->n;
+}
+
+/************************************************************************//**
+ * Adds a key to a MAC table if it is not already there.
+ *
+ * @param[in,out] table : MAC table
+ * @param[in]     key   : OPS_MAC_KEY(vlan, mac)
+ * @param[in]     data  : value to store with key
+ *
+ * @return true if key was added, false if it was present, in which case its
+ *         value is left unchanged
+ ***************************************************************************/
+extern bool ops_mac_table_insert(struct ops_mac_table *table, uint64_t key,
+                                 void *data);
+
+/************************************************************************//**
+ * Looks up a key in a MAC table.
+ *
+ * @param[in]  table : MAC table
+ * @param[in]  key   : OPS_MAC_KEY(vlan, mac)
+ * @param[out] data  : value stored with key, if found, may be NULL
+ *
+ * @return true if key is present, else false
+ ***************************************************************************/
+extern bool ops_mac_table_lookup(const struct ops_mac_table *table,
+                                 uint64_t key, void **data);
+
+/************************************************************************//**
+ * Removes a key from a MAC table.
+ *
+ * @param[in,out] table : MAC table
+ * @param[in]     key   : OPS_MAC_KEY(vlan, mac)
+ * @param[out]    data  : value that was stored with key, may be NULL
+ *
+ * @return true if key was present, else false
+ ***************************************************************************/
+extern bool ops_mac_table_remove(struct ops_mac_table *table, uint64_t key,
+                                 void **data);
+
+/************************************************************************//**
+ * Adds n keys to a MAC table, growing it at most once.
+ *
+ * @param[in,out] table    : MAC table
+ * @param[in]     keys     : keys to add
+ * @param[in]     data     : value for each key, may be NULL to store NULL
+ * @param[in]     n        : number of keys
+ * @param[out]    inserted : per key result of ops_mac_table_insert, may be
+ *                           NULL
+ *
+ * @return number of keys added
+ ***************************************************************************/
+extern size_t ops_mac_table_insert_batch(struct ops_mac_table *table,
+                                         const uint64_t *keys,
+                                         void *const *data, size_t n,
+                                         bool *inserted);
+
+/************************************************************************//**
+ * Looks up n keys in a MAC table. The hashes of a block of keys are
+ * computed and their control bytes prefetched before any key is probed.
+ *
+ * @param[in]  table : MAC table
+ * @param[in]  keys  : keys to look up
+ * @param[in]  n     : number of keys
+ * @param[out] data  : value of each key found, NULL for the others, may be
+ *                     NULL
+ * @param[out] found : per key result, may be NULL
+ *
+ * @return number of keys found
+ ***************************************************************************/
+extern size_t ops_mac_table_lookup_batch(const struct ops_mac_table *table,
+                                         const uint64_t *keys, size_t n,
+                                         void **data, bool *found);
+
+/************************************************************************//**
+ * Removes n keys from a MAC table.
+ *
+ * @return number of keys that were present
+ ***************************************************************************/
+extern size_t ops_mac_table_remove_batch(struct ops_mac_table *table,
+                                         const uint64_t *keys, size_t n);
+
+/************************************************************************//**
+ * Finds the first used slot at or after pos, for OPS_MAC_TABLE_FOR_EACH.
+ *
+ * @return slot index, or table->capacity if there is none
+ ***************************************************************************/
+extern size_t ops_mac_table_next(const struct ops_mac_table *table,
+                                 size_t pos);
+
+/* A MAC address, as a 48-bit integer, and the value stored with it */
+struct ops_mac_index_entry {
+    uint64_t mac;
+    void *data;
+};
+
+/*
+ * Ordered index of MAC addresses, answering OUI, prefix and range queries
+ * in O(log n + k). Entries are kept sorted in chunks of bounded size, so
+ * that insertion and removal only move entries within one chunk. The
+ * same MAC may be present several times with different data. Initialize
+ * with ops_mac_index_init, the members are private.
+ */
+struct ops_mac_index {
+    struct mac_index_chunk **chunks;   /* Sorted, none empty */
+    size_t n_chunks;
+    size_t allocated_chunks;
+    size_t n;                          /* Entries in all chunks */
+};
+
+/* Position in an ops_mac_index range query */
+struct ops_mac_index_cursor {
+    const struct ops_mac_index *index;
+    size_t chunk;
+    size_t pos;
+    uint64_t last;                     /* Last MAC of the range */
+};
+
+/* Iterates ENTRY over the entries of INDEX with a MAC in [FIRST, LAST], in
+ * ascending MAC order. The index must not be modified during iteration. */
+#define OPS_MAC_INDEX_FOR_EACH_RANGE(ENTRY, CURSOR, INDEX, FIRST, LAST)   \
+    for (ops_mac_index_cursor_init(CURSOR, INDEX, FIRST, LAST);           \
+         ((ENTRY) = ops_mac_index_cursor_next(CURSOR)) != NULL; )
+
+/* Iterates ENTRY over the entries of INDEX whose MAC starts with the
+ * 24-bit OUI, in ascending MAC order */
+#define OPS_MAC_INDEX_FOR_EACH_OUI(ENTRY, CURSOR, INDEX, OUI)             \
+    OPS_MAC_INDEX_FOR_EACH_RANGE(ENTRY, CURSOR, INDEX,                    \
+                                 (uint64_t) (OUI) << 24,                  \
+                                 ((uint64_t) (OUI) << 24) | 0xffffff)
+
+/************************************************************************//**
+ * Initializes an empty MAC index.
+ ***************************************************************************/
+extern void ops_mac_index_init(struct ops_mac_index *index);
+
+/************************************************************************//**
+ * Frees the memory of a MAC index. The data pointers are not freed.
+ ***************************************************************************/
+extern void ops_mac_index_destroy(struct ops_mac_index *index);
+
+/************************************************************************//**
+ * Counts the entries in a MAC index.
+ ***************************************************************************/
+static inline size_t
+ops_mac_index_count(const struct ops_mac_index *index)
+{
+    return index->n;
+}
+
+/************************************************************************//**
+ * Adds an entry to a MAC index.
+ *
+ * @param[in,out] index : MAC index
+ * @param[in]     mac   : MAC address as returned by
+ *                        ops_char_array_to_ulong_long(addr, ETH_ALEN)
+ * @param[in]     data  : value to store with mac
+ ***************************************************************************/
+extern void ops_mac_index_insert(struct ops_mac_index *index, uint64_t mac,
+                                 void *data);
+
+/************************************************************************//**
+ * Adds an entry to a MAC index, taking the MAC in binary form.
+ ***************************************************************************/
+extern void ops_mac_index_insert_addr(struct ops_mac_index *index,
+                                      const struct ether_addr *addr,
+                                      void *data);
+
+/************************************************************************//**
+ * Removes the entry with both the given MAC and data from a MAC index.
+ *
+ * @return true if such an entry was present, else false
+ ***************************************************************************/
+extern bool ops_mac_index_remove(struct ops_mac_index *index, uint64_t mac,
+                                 void *data);
+
+/************************************************************************//**
+ * Starts a query for the entries with a MAC in [first, last].
+ ***************************************************************************/
+extern void ops_mac_index_cursor_init(struct ops_mac_index_cursor *cursor,
+                                      const struct ops_mac_index *index,
+                                      uint64_t first, uint64_t last);
+
+/************************************************************************//**
+ * Starts a query for the entries whose MAC begins with the first
+ * prefix_len bits of prefix, e.g. prefix_len 24 for an OUI or 28 for an
+ * IEEE MA-M block.
+ ***************************************************************************/
+extern void
+ops_mac_index_cursor_init_prefix(struct ops_mac_index_cursor *cursor,
+                                 const struct ops_mac_index *index,
+                                 uint64_t prefix, unsigned int prefix_len);
+
+/************************************************************************//**
+ * Steps a query to its next entry.
+ *
+ * @return next entry in ascending MAC order, or NULL at the end of the
+ *         range
+ ***************************************************************************/
+extern const struct ops_mac_index_entry *
+ops_mac_index_cursor_next(struct ops_mac_index_cursor *cursor);
+
+/*
+ * Allocator of MAC addresses from a contiguous range, e.g. the block
+ * following the system MAC that is handed out to SVIs, LAGs and VRFs.
+ * Allocated offsets are kept in a bitmap, so allocation and release are
+ * O(1) amortized. Initialize with ops_mac_pool_init, the members are
+ * private.
+ */
+struct ops_mac_pool {
+    uint64_t base;                     /* First MAC of the range */
+    size_t size;                       /* Number of MACs in the range */
+    uint64_t *used;                    /* Bit per offset, set if allocated */
+    size_t n_words;
+    size_t n_used;
+    size_t hint;                       /* No free offset in earlier words */
+};
+
+/************************************************************************//**
+ * Initializes a pool with all MACs from base to base + size - 1 free.
+ *
+ * @param[out] pool : MAC pool
+ * @param[in]  base : first MAC of the range, as a 48-bit value
+ * @param[in]  size : number of MACs in the range
+ *
+ * @return true on success, else false if the range is empty or does not
+ *         fit in 48 bits
+ ***************************************************************************/
+extern bool ops_mac_pool_init(struct ops_mac_pool *pool, uint64_t base,
+                              size_t size);
+
+/************************************************************************//**
+ * Frees the memory of a pool.
+ ***************************************************************************/
+extern void ops_mac_pool_destroy(struct ops_mac_pool *pool);
+
+/************************************************************************//**
+ * Counts the free MACs of a pool.
+ ***************************************************************************/
+static inline size_t
+ops_mac_pool_count_free(const struct ops_mac_pool *pool)
+{
+    return pool->size - pool->n_used;
+}
+
+/************************************************************************//**
+ * Allocates the lowest free MAC of a pool.
+ *
+ * @param[in,out] pool : MAC pool
+ * @param[out]    mac  : allocated MAC
+ *
+ * @return true on success, else false if the pool is exhausted
+ ***************************************************************************/
+extern bool ops_mac_pool_alloc(struct ops_mac_pool *pool, uint64_t *mac);
+
+/************************************************************************//**
+ * Allocates n consecutive MACs, the lowest such run of the pool.
+ *
+ * @param[in,out] pool  : MAC pool
+ * @param[in]     n     : number of MACs
+ * @param[out]    first : first allocated MAC
+ *
+ * @return true on success, else false if there is no run of n free MACs
+ ***************************************************************************/
+extern bool ops_mac_pool_alloc_range(struct ops_mac_pool *pool, size_t n,
+                                     uint64_t *first);
+
+/************************************************************************//**
+ * Marks a MAC as allocated, e.g. one found in the database at startup.
+ *
+ * @return true if mac was free, else false if it is outside the pool or
+ *         already allocated
+ ***************************************************************************/
+extern bool ops_mac_pool_mark_used(struct ops_mac_pool *pool, uint64_t mac);
+
+/************************************************************************//**
+ * Returns n consecutive MACs starting at first to the pool.
+ *
+ * @return true if all of them were allocated, else false and nothing is
+ *         freed
+ ***************************************************************************/
+extern bool ops_mac_pool_free_range(struct ops_mac_pool *pool,
+                                    uint64_t first, size_t n);
+
+/************************************************************************//**
+ * Returns a MAC to the pool.
+ *
+ * @return true if mac was allocated, else false
+ ***************************************************************************/
+extern bool ops_mac_pool_free(struct ops_mac_pool *pool, uint64_t mac);
+
+/************************************************************************//**
+ * Restores the allocations of a pool from the MAC strings found in the
+ * database, in one pass. Strings that do not parse or are outside the pool
+ * are skipped.
+ *
+ * @param[in,out] pool     : MAC pool
+ * @param[in]     mac_strs : MAC address strings, e.g. a column of the rows
+ *                           the daemon assigned MACs to
+ * @param[in]     n        : number of strings
+ *
+ * @return number of MACs marked as allocated
+ ***************************************************************************/
+extern size_t ops_mac_pool_restore(struct ops_mac_pool *pool,
+                                   const char *const *mac_strs, size_t n);
+
+#endif /* __MAC_UTILS_H_ */
+/** @} end of group mac_utils_public */
+/** @} end of group mac_utils */
@@ -36,9 +36,14 @@
 #ifndef __OPS_UTILS_H_
 #define __OPS_UTILS_H_
 
+#include <endian.h>
+#include <stdint.h>
+#include <string.h>
 #include <netinet/ether.h>
+#include "hmapx.h"
 #include "shash.h"
 #include "vswitch-idl.h"
+#include "vlan-bitmap.h"
 
 /******************* MATH *************************/
 
@@ -93,6 +98,88 @@ extern unsigned long long
 extern void ops_ulong_long_to_char_array(unsigned long long value,
         unsigned int length, unsigned char *char_array);
 
+/************************************************************************//**
+ * Inline equivalent of ops_char_array_to_ulong_long(addr, ETH_ALEN), done
+ * with one unaligned load and a byte swap.
+ *
+ * @param[in]  addr   :6 byte binary array with MAC address
+ *
+ * @return 48-bit MAC address
+ ***************************************************************************/
+static inline uint64_t
+ops_mac_to_ulong_long(const unsigned char *addr)
+{
+    uint64_t value = 0;
+
+    memcpy(&value, addr, ETH_ALEN);
+    return be64toh(value) >> 16;
+}
+
+/************************************************************************//**
+ * Inline equivalent of ops_ulong_long_to_char_array(mac, ETH_ALEN, addr).
+ *
+ * @param[in]  mac    :48-bit MAC address
+ * @param[out] addr   :6 byte binary array
+ ***************************************************************************/
+static inline void
+ops_ulong_long_to_mac(uint64_t mac, unsigned char *addr)
+{
+    uint64_t value = htobe64(mac << 16);
+
+    memcpy(addr, &value, ETH_ALEN);
+}
+
+/************************************************************************//**
+ * Inline equivalent of ops_char_array_to_ulong_long(wwn, 8).
+ *
+ * @param[in]  wwn    :8 byte binary array with World Wide Name
+ *
+ * @return 64-bit WWN
+ ***************************************************************************/
+static inline uint64_t
+ops_wwn_to_ulong_long(const unsigned char *wwn)
+{
+    uint64_t value;
+
+    memcpy(&value, wwn, sizeof value);
+    return be64toh(value);
+}
+
+/************************************************************************//**
+ * Inline equivalent of ops_ulong_long_to_char_array(value, 8, wwn).
+ *
+ * @param[in]  value  :64-bit WWN
+ * @param[out] wwn    :8 byte binary array
+ ***************************************************************************/
+static inline void
+ops_ulong_long_to_wwn(uint64_t value, unsigned char *wwn)
+{
+    value = htobe64(value);
+    memcpy(wwn, &value, sizeof value);
+}
+
+/************************************************************************//**
+ * Converts n MAC addresses packed back to back as 6 byte arrays, as in
+ * wire format, into 48-bit values.
+ *
+ * @param[in]  addrs  :n * ETH_ALEN bytes of MAC addresses
+ * @param[in]  n      :number of addresses
+ * @param[out] macs   :48-bit MAC addresses
+ ***************************************************************************/
+extern void ops_mac_array_to_ulong_long(const unsigned char *addrs, size_t n,
+        uint64_t *macs);
+
+/************************************************************************//**
+ * Converts n 48-bit values into MAC addresses packed back to back as 6
+ * byte arrays.
+ *
+ * @param[in]  macs   :48-bit MAC addresses
+ * @param[in]  n      :number of addresses
+ * @param[out] addrs  :n * ETH_ALEN bytes of MAC addresses
+ ***************************************************************************/
+extern void ops_ulong_long_to_mac_array(const uint64_t *macs, size_t n,
+        unsigned char *addrs);
+
 /************************************************************************//**
  * Converts an Ethernet address stored as a 6 byte binary array
  * into a printable mac address with leading zeros.
@@ -116,6 +203,76 @@ extern char *ops_ether_array_to_string(char *mac_a, const unsigned char *addr);
 extern char *ops_ether_ulong_long_to_string(char *mac_a,
         const unsigned long long mac);
 
+/************************************************************************//**
+ * Converts n Ethernet addresses into printable mac addresses with leading
+ * zeros, stored back to back in one buffer.
+ *
+ * @param[out] buf    :buffer of n * OPS_MAC_STR_SIZE bytes, address i is
+ *                     formatted at buf + i * OPS_MAC_STR_SIZE
+ * @param[in]  addrs  :Ethernet addresses
+ * @param[in]  n      :number of addresses
+ *
+ * @return buf
+ ***************************************************************************/
+extern char *ops_ether_ntoa_batch(char *buf, const struct ether_addr *addrs,
+        size_t n);
+
+/************************************************************************//**
+ * Converts n Ethernet addresses stored as long longs into printable mac
+ * addresses with leading zeros, stored back to back in one buffer.
+ *
+ * @param[out] buf    :buffer of n * OPS_MAC_STR_SIZE bytes, address i is
+ *                     formatted at buf + i * OPS_MAC_STR_SIZE, or is an
+ *                     empty string if it does not fit in 48 bits
+ * @param[in]  macs   :ull MAC addresses
+ * @param[in]  n      :number of addresses
+ *
+ * @return number of addresses formatted
+ ***************************************************************************/
+extern size_t ops_ether_ulong_long_to_string_batch(char *buf,
+        const unsigned long long *macs, size_t n);
+
+/************************************************************************//**
+ * Parses a MAC address string in the "aa:bb:cc:dd:ee:ff",
+ * "aa-bb-cc-dd-ee-ff" or "aabb.ccdd.eeff" form, in either case, into
+ * the value ops_char_array_to_ulong_long would give for its bytes.
+ *
+ * @param[in]  mac_a  :MAC address string
+ * @param[out] mac    :ull MAC address, unchanged on failure
+ *
+ * @return true if mac_a is a valid MAC address, else false
+ ***************************************************************************/
+extern bool ops_ether_string_to_ulong_long(const char *mac_a,
+        unsigned long long *mac);
+
+/************************************************************************//**
+ * World Wide Name version of ops_ether_string_to_ulong_long, taking 8
+ * bytes in the "aa:bb:cc:dd:ee:ff:00:11", '-' or "aabb.ccdd.eeff.0011"
+ * form.
+ *
+ * @param[in]  wwn_a  :WWN address string
+ * @param[out] wwn    :ull WWN, unchanged on failure
+ *
+ * @return true if wwn_a is a valid WWN, else false
+ ***************************************************************************/
+extern bool ops_wwn_string_to_ulong_long(const char *wwn_a,
+        unsigned long long *wwn);
+
+/************************************************************************//**
+ * Parses n MAC address strings as ops_ether_string_to_ulong_long. The
+ * common "aa:bb:cc:dd:ee:ff" form is validated and decoded with SSE2 where
+ * available.
+ *
+ * @param[in]  strs   :MAC address strings
+ * @param[in]  n      :number of strings
+ * @param[out] macs   :ull MAC addresses, 0 for invalid strings
+ * @param[out] ok     :per string result, may be NULL
+ *
+ * @return number of valid strings
+ ***************************************************************************/
+extern size_t ops_ether_string_to_ulong_long_batch(const char *const *strs,
+        size_t n, unsigned long long *macs, bool *ok);
+
 
 /******************* PID Utility *******************/
 
@@ -335,6 +492,137 @@ int ops_mac_get_vlan(const struct ovsrec_mac *mac_row);
 const struct ovsrec_vlan * ops_get_vlan_by_id(int vlan_id,
                                               struct ovsdb_idl *idl);
 
+/******************************************************************************
+ * Invalidates the VLAN id index used by ops_get_vlan_by_id.
+ *
+ * ops_get_vlan_by_id and the VLAN setters resolve ids through a 4096 entry
+ * table of the VLAN rows, rebuilt when the IDL sequence number changes, so
+ * that looking up a VLAN that does not exist costs no more than one that
+ * does. Rows deleted in the caller's open transaction are never returned,
+ * and rows it inserted before the table was built are found. The sequence
+ * number does not change for the caller's own writes, so a caller that
+ * inserts or renumbers VLANs after a lookup and looks them up in the same
+ * transaction must call this function first. The table is a single
+ * process-wide cache, rebuilt when another IDL is passed, so these
+ * functions are not thread-safe.
+ *****************************************************************************/
+void ops_vlan_index_invalidate(void);
+
+/******************************************************************************
+ * Setter function for trunk column of port table taking a VLAN bitmap
+ *
+ * @param[in]  trunks   : set of VLANs to trunk on the port
+ * @param[in]  port_row : port table record for which trunked VLANs
+ *                        record has to be set
+ * @param[in]  idl      : pointer to ovsdb handler
+ *
+ * @return true for success, else false if any VLAN in trunks does not exist
+ *****************************************************************************/
+bool ops_port_set_trunks_bitmap(const struct ops_vlan_bitmap *trunks,
+                                const struct ovsrec_port *port_row,
+                                struct ovsdb_idl *idl);
+
+/******************************************************************************
+ * Getter function for trunk column of port table returning a VLAN bitmap
+ *
+ * @param[in]  port_row : port table record for which trunk VLANs have to be
+ *                        fetched
+ * @param[out] trunks   : set of VLANs trunked on the port
+ *****************************************************************************/
+void ops_port_get_trunks_bitmap(const struct ovsrec_port *port_row,
+                                struct ops_vlan_bitmap *trunks);
+
+/******************************************************************************
+ * Getter function for the trunk VLANs of a group of ports, such as the
+ * members of a LAG. Each port's trunks are read once and folded into both
+ * results with the vectorized set operations of the vlan-bitmap library.
+ *
+ * @param[in]  port_rows : port table records of the group
+ * @param[in]  n         : number of ports in port_rows
+ * @param[out] common    : VLANs trunked on every port, may be NULL
+ * @param[out] all       : VLANs trunked on any port, may be NULL
+ *****************************************************************************/
+void ops_port_group_get_trunks(const struct ovsrec_port *const *port_rows,
+                               size_t n,
+                               struct ops_vlan_bitmap *common,
+                               struct ops_vlan_bitmap *all);
+
+/* VLAN membership of one port, for ops_port_set_vlans */
+struct ops_port_vlan_assignment {
+    const struct ovsrec_port *port_row;   /*!< Port to configure */
+    int access_vlan;                      /*!< Tag VLAN id, 0 to clear the
+                                               tag, negative to leave it */
+    const struct ops_vlan_bitmap *trunks; /*!< Trunk VLANs, NULL to leave
+                                               them, may be shared between
+                                               entries */
+    bool ok;                              /*!< Set to true if applied */
+};
+
+/******************************************************************************
+ * Applies VLAN membership to many ports in the caller's transaction.
+ *
+ * The VLAN table is resolved once for the whole batch, so a rollout costs
+ * O(ports + VLANs) rather than a VLAN lookup per port and per trunk. Each
+ * entry is applied on its own: an entry naming a VLAN that does not exist
+ * is left unapplied with ok set to false, and does not stop the others.
+ * Columns that already hold the requested value are not written.
+ *
+ * @param[in,out] assignments : ports and their VLANs, the ok member of each
+ *                              entry is set to the result for that port
+ * @param[in]     n           : number of entries in assignments
+ * @param[in]     idl         : pointer to ovsdb handler
+ *
+ * @return number of ports whose assignment was applied
+ *****************************************************************************/
+size_t ops_port_set_vlans(struct ops_port_vlan_assignment *assignments,
+                          size_t n,
+                          struct ovsdb_idl *idl);
+
+/******************************************************************************
+ * Brings the VLAN member index up to date with the Port table.
+ *
+ * The index maps each VLAN id to the ports that carry it, as tag or trunk.
+ * It is built with one scan of the Port table, then patched from the Port
+ * rows reported by IDL change tracking when the Port table seqno moves.
+ * A Port change that tracking does not report triggers a new scan instead,
+ * so the index is always current; to keep updates incremental, track the
+ * Port columns (ovsdb_idl_track_add_column) and call this function, or one
+ * of the member queries below, before ovsdb_idl_track_clear.
+ *
+ * @param[in]  idl : pointer to ovsdb handler
+ *****************************************************************************/
+void ops_vlan_members_run(struct ovsdb_idl *idl);
+
+/******************************************************************************
+ * Drops the VLAN member index, so that the next query rebuilds it from a
+ * full scan of the Port table. Needed after changing the VLANs of ports in
+ * an uncommitted transaction, which leaves the Port table seqno alone.
+ *****************************************************************************/
+void ops_vlan_members_invalidate(void);
+
+/******************************************************************************
+ * Getter function for the ports carrying a VLAN
+ *
+ * @param[in]  vlan_id : vlan id whose member ports have to be fetched
+ * @param[in]  idl     : pointer to ovsdb handler
+ *
+ * @return set of const struct ovsrec_port pointers, valid until the next
+ *         call to ovsdb_idl_run, or NULL if vlan_id is out of range
+ *****************************************************************************/
+const struct hmapx *ops_vlan_get_members(int vlan_id,
+                                         struct ovsdb_idl *idl);
+
+/******************************************************************************
+ * Getter function for the number of ports carrying a VLAN
+ *
+ * @param[in]  vlan_id : vlan id whose member ports have to be counted
+ * @param[in]  idl     : pointer to ovsdb handler
+ *
+ * @return number of ports with vlan_id as tag or trunk
+ *****************************************************************************/
+size_t ops_vlan_get_member_count(int vlan_id,
+                                 struct ovsdb_idl *idl);
+
 /*****************************************************************************
 sends a ICMP_ECHO packet to the target.
  @param[in] target: ipv4 address string of the target to ping
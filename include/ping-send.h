@@ -0,0 +1,240 @@
+/*
+ *(c) Copyright 2016 Hewlett Packard Enterprise Development LP.
+ *
+ *   Licensed under the Apache License, Version 2.0 (the "License"); you may
+ *   not use this file except in compliance with the License. You may obtain
+ *   a copy of the License at
+ *
+ *        http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *   Unless required by applicable law or agreed to in writing, software
+ *   distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ *   WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+ *   License for the specific language governing permissions and limitations
+ *   under the License.
+ */
+
+/************************************************************************//**
+ * @defgroup ping_send Core Utilities
+ * This library provides common utility functions used by various OpenSwitch
+ * processes.
+ * @{
+ *
+ * @defgroup ping_send_public Public Interface
+ * Public API for ping_send library.
+ *
+ * ICMP and ICMPv6 echo probing of many targets over long-lived sockets,
+ * for reachability monitoring. ping4() and ping6() in ops-utils.h remain
+ * for one-off echoes.
+ *
+ * @{
+ *
+ * @file
+ * Header for ping_send library.
+ ***************************************************************************/
+
+#ifndef __PING_SEND_H_
+#define __PING_SEND_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct ops_ping_engine;
+struct ops_ping_scheduler;
+
+/* Reachability counters of one probe target */
+struct ops_ping_stats {
+    uint64_t sent;                     /* Echo requests sent */
+    uint64_t received;                 /* Echo replies matched */
+    uint64_t lost;                     /* Requests that timed out */
+    uint64_t send_errors;              /* Requests the kernel refused, e.g.
+                                        * with no route to the target */
+    uint32_t last_rtt_us;              /* RTT of the latest reply */
+    uint32_t min_rtt_us;
+    uint32_t max_rtt_us;
+    uint64_t sum_rtt_us;               /* Sum over all replies, for the mean */
+};
+
+/************************************************************************//**
+ * Creates a probe engine with its own ICMP and ICMPv6 raw sockets.
+ *
+ * Each engine stamps its echoes with one of its own range of 16 ICMP ids
+ * and a sequence number, so that replies are matched to their target with
+ * a hash lookup. That numbers 2^20 probes before one is reused, and an
+ * engine takes at most 2^20 - 1 targets. A target has at most one probe
+ * outstanding, a probe unanswered after timeout_ms counts as lost. A probe
+ * is only given up before its timeout if 2^20 - 1 later probes are sent
+ * without ops_ping_engine_run being called in between.
+ *
+ * @param[in]  vrf_ns_name : namespace of the VRF to probe in, as for
+ *                           vrf_create_socket, or NULL for the current
+ *                           namespace
+ * @param[in]  timeout_ms  : time to wait for a reply
+ *
+ * @return new engine, or NULL if neither socket could be opened
+ ***************************************************************************/
+extern struct ops_ping_engine *ops_ping_engine_create(const char *vrf_ns_name,
+                                                      unsigned int timeout_ms);
+
+/************************************************************************//**
+ * Closes the sockets of an engine and frees it with all its targets.
+ ***************************************************************************/
+extern void ops_ping_engine_destroy(struct ops_ping_engine *engine);
+
+/************************************************************************//**
+ * Adds a target to probe.
+ *
+ * @param[in,out] engine : probe engine
+ * @param[in]     target : IPv4 or IPv6 address string. A link-local IPv6
+ *                          address needs its zone, as in "fe80::1%eth0" or
+ *                          "fe80::1%5". Interface names are looked up in
+ *                          the namespace of the calling process, give the
+ *                          ifindex for targets in another VRF.
+ *
+ * @return target id, or -1 if target is not a valid address, is link-local
+ *         without a zone, or the engine has no socket for its family or is
+ *         full. Ids of removed targets are reused.
+ ***************************************************************************/
+extern int ops_ping_engine_add_target(struct ops_ping_engine *engine,
+                                      const char *target);
+
+/************************************************************************//**
+ * Removes a target. A reply to its outstanding probe is ignored.
+ *
+ * @return true if id was a target of the engine, else false
+ ***************************************************************************/
+extern bool ops_ping_engine_remove_target(struct ops_ping_engine *engine,
+                                          int id);
+
+/************************************************************************//**
+ * Sends an echo request to one target. A probe still outstanding for the
+ * target counts as lost.
+ *
+ * @return true if the request was sent, else false
+ ***************************************************************************/
+extern bool ops_ping_engine_send(struct ops_ping_engine *engine, int id);
+
+/************************************************************************//**
+ * Sends an echo request to each of the listed targets, batching the
+ * requests in as few system calls as possible. Ids that are not targets
+ * of the engine are skipped.
+ *
+ * @return number of requests sent
+ ***************************************************************************/
+extern size_t ops_ping_engine_send_many(struct ops_ping_engine *engine,
+                                        const int *ids, size_t n);
+
+/************************************************************************//**
+ * Sends an echo request to every target, batching the requests in as few
+ * system calls as possible.
+ *
+ * @return number of requests sent
+ ***************************************************************************/
+extern size_t ops_ping_engine_send_all(struct ops_ping_engine *engine);
+
+/************************************************************************//**
+ * Reads the pending replies, updates the statistics of their targets and
+ * expires the probes that timed out. Does not block.
+ *
+ * @return number of replies matched to a target
+ ***************************************************************************/
+extern size_t ops_ping_engine_run(struct ops_ping_engine *engine);
+
+/************************************************************************//**
+ * Arranges for the poll loop to wake up when a reply arrives or the oldest
+ * outstanding probe times out.
+ ***************************************************************************/
+extern void ops_ping_engine_wait(struct ops_ping_engine *engine);
+
+/************************************************************************//**
+ * Getter function for the statistics of a target.
+ *
+ * @param[in]  engine : probe engine
+ * @param[in]  id     : target id
+ * @param[out] stats  : counters of the target since it was added
+ *
+ * @return true on success, else false if id is not a target of the engine
+ ***************************************************************************/
+extern bool ops_ping_engine_get_stats(const struct ops_ping_engine *engine,
+                                      int id, struct ops_ping_stats *stats);
+
+/************************************************************************//**
+ * Checks if a target answered its latest completed probe.
+ *
+ * @return true if the last probe of target id got a reply, false if it was
+ *         lost or could not be sent, if none completed yet or if id is not
+ *         a target
+ ***************************************************************************/
+extern bool ops_ping_engine_is_reachable(const struct ops_ping_engine *engine,
+                                         int id);
+
+/************************************************************************//**
+ * Creates a scheduler that sends the probes of an engine, each target at
+ * its own interval.
+ *
+ * Targets are kept in a hierarchical timing wheel of four levels of 256
+ * slots, so scheduling, rescheduling and expiry are O(1) per target
+ * whatever the number of targets. The first probe of each target is
+ * offset within its interval along a low-discrepancy sequence, which
+ * spreads the sends of targets sharing an interval evenly instead of in
+ * bursts. A single timerfd, set for the next tick with probes due, wakes
+ * the poll loop. Use one engine and one scheduler per VRF.
+ *
+ * @param[in]  engine  : engine sending the probes, must outlive the
+ *                       scheduler
+ * @param[in]  tick_ms : wheel resolution, intervals are rounded up to it
+ *
+ * @return new scheduler, or NULL if the timerfd could not be created
+ ***************************************************************************/
+extern struct ops_ping_scheduler *
+ops_ping_scheduler_create(struct ops_ping_engine *engine,
+                          unsigned int tick_ms);
+
+/************************************************************************//**
+ * Closes the timerfd of a scheduler and frees it. The engine and its
+ * targets are left alone.
+ ***************************************************************************/
+extern void ops_ping_scheduler_destroy(struct ops_ping_scheduler *sched);
+
+/************************************************************************//**
+ * Schedules periodic probes of a target, or changes the interval of a
+ * scheduled target.
+ *
+ * @param[in,out] sched       : scheduler
+ * @param[in]     id          : target id from ops_ping_engine_add_target
+ * @param[in]     interval_ms : time between probes
+ *
+ * @return true on success, else false if id or interval_ms is invalid
+ ***************************************************************************/
+extern bool ops_ping_scheduler_add(struct ops_ping_scheduler *sched, int id,
+                                   unsigned int interval_ms);
+
+/************************************************************************//**
+ * Stops the probes of a target. Call it before removing the target from
+ * the engine.
+ *
+ * @return true if id was scheduled, else false
+ ***************************************************************************/
+extern bool ops_ping_scheduler_remove(struct ops_ping_scheduler *sched,
+                                      int id);
+
+/************************************************************************//**
+ * Advances the wheel to the current time and sends the probes that came
+ * due, in batches. A target is probed at most once per run however late
+ * the run is, the probes missed meanwhile are skipped. Replies are still
+ * collected with ops_ping_engine_run.
+ *
+ * @return number of probes sent
+ ***************************************************************************/
+extern size_t ops_ping_scheduler_run(struct ops_ping_scheduler *sched);
+
+/************************************************************************//**
+ * Arranges for the poll loop to wake up when the next probe is due, if any
+ * target is scheduled.
+ ***************************************************************************/
+extern void ops_ping_scheduler_wait(struct ops_ping_scheduler *sched);
+
+#endif /* __PING_SEND_H_ */
+/** @} end of group ping_send_public */
+/** @} end of group ping_send */
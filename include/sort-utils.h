@@ -0,0 +1,253 @@
+/*
+ Copyright (C) 2016 Hewlett-Packard Development Company, L.P.
+ All Rights Reserved.
+
+    Licensed under the Apache License, Version 2.0 (the "License"); you may
+    not use this file except in compliance with the License. You may obtain
+    a copy of the License at
+
+         http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+    WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+    License for the specific language governing permissions and limitations
+    under the License.
+*/
+
+/************************************************************************//**
+ * @defgroup sort_utils Core Utilities
+ * This library provides common utility functions used by various OpenSwitch
+ * processes.
+ * @{
+ *
+ * @defgroup sort_utils_public Public Interface
+ * Public API for sort_utils library.
+ *
+ * Alternatives to ops_sort for large shash tables. Comparators have the
+ * signature ops_sort takes: they are called with two pointers to
+ * const struct shash_node pointers.
+ *
+ * @{
+ *
+ * @file
+ * Header for sort_utils library.
+ ***************************************************************************/
+
+#ifndef __SORT_UTILS_H_
+#define __SORT_UTILS_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "shash.h"
+
+/* Extracts the sort key of a node. Keys must order nodes the way the
+ * comparator used with them does, with equal keys for nodes it can only
+ * tell apart by comparison. */
+typedef uint64_t ops_sort_key_func(const struct shash_node *node);
+
+/************************************************************************//**
+ * Sorts the nodes of a shash by a 64-bit key extracted once per node.
+ *
+ * The keys are sorted with an LSD radix sort, skipping the byte positions
+ * where all keys agree, so no comparator is called for nodes with distinct
+ * keys. Runs of nodes with equal keys are then ordered with ptr_func_sort.
+ *
+ * @param[in]  sh            : shash containing unsorted elements
+ * @param[in]  key_func      : key extractor, e.g. ops_sort_key_name_prefix
+ * @param[in]  ptr_func_sort : comparator for nodes with equal keys, as for
+ *                             ops_sort, may be NULL if keys are unique or
+ *                             their order does not matter
+ * @param[out] sorted_list   : array of shash_count(sh) entries allocated
+ *                             by the caller
+ *
+ * @return zero for success, else non-zero on failure
+ ***************************************************************************/
+extern int ops_sort_by_key(const struct shash *sh, ops_sort_key_func *key_func,
+                           void *ptr_func_sort,
+                           const struct shash_node **sorted_list);
+
+/************************************************************************//**
+ * Key extractor for sorting by name: the first 8 bytes of the node name,
+ * so that strcmp is only needed for names sharing that prefix.
+ ***************************************************************************/
+extern uint64_t ops_sort_key_name_prefix(const struct shash_node *node);
+
+/************************************************************************//**
+ * Key extractor for names that are unsigned decimal numbers, such as VLAN
+ * ids. Names that are not numbers sort after all numbers.
+ ***************************************************************************/
+extern uint64_t ops_sort_key_name_number(const struct shash_node *node);
+
+/* Size of the buffer that holds any natural-order key */
+#define OPS_SORT_NATURAL_KEY_MAX  64
+
+/************************************************************************//**
+ * Computes the natural-order key of a name, such as "1/1/2", "lag100" or
+ * "vlan20". Comparing two keys with memcmp, the shorter first on a common
+ * prefix, orders names with their numbers compared by value, so "1/1/2"
+ * comes before "1/1/10". Each run of digits is packed as one byte giving
+ * its length followed by its value in big endian, other bytes are kept.
+ * Names that differ only in leading zeros get equal keys.
+ *
+ * @param[in]  name : name to compute the key of
+ * @param[out] key  : buffer of OPS_SORT_NATURAL_KEY_MAX bytes, longer keys
+ *                    are truncated
+ *
+ * @return length of the key in bytes
+ ***************************************************************************/
+extern size_t ops_sort_natural_key(const char *name, uint8_t *key);
+
+/************************************************************************//**
+ * Comparator for ops_sort ordering shash nodes by name in natural order.
+ * It computes both keys on every call, prefer ops_sort_natural for whole
+ * tables.
+ ***************************************************************************/
+extern int ops_sort_natural_compare(const void *a, const void *b);
+
+/************************************************************************//**
+ * Sorts the nodes of a shash by name in natural order.
+ *
+ * The natural-order key of each name is computed once. Nodes are radix
+ * sorted on the first 8 key bytes, which for names such as "1/1/2" hold
+ * the whole key, and compared with memcmp only where those are equal.
+ * Names with equal keys are ordered with strcmp.
+ *
+ * @param[in]  sh          : shash containing unsorted elements
+ * @param[out] sorted_list : array of shash_count(sh) entries allocated by
+ *                           the caller
+ *
+ * @return zero for success, else non-zero on failure
+ ***************************************************************************/
+extern int ops_sort_natural(const struct shash *sh,
+                            const struct shash_node **sorted_list);
+
+/*
+ * Sorted array of the nodes of a shash, kept across requests. A view is
+ * fully re-sorted only when marked dirty, through ops_sorted_view_invalidate
+ * or a changed sequence number. Nodes added or removed one at a time are
+ * placed by binary search instead. Initialize with ops_sorted_view_init,
+ * the members are private.
+ */
+struct ops_sorted_view {
+    const struct shash *sh;
+    void *ptr_func_sort;               /* Comparator, as for ops_sort */
+    const struct shash_node **nodes;
+    size_t n;
+    size_t allocated;
+    unsigned int seqno;                /* Last ops_sorted_view_set_seqno */
+    bool dirty;
+};
+
+/************************************************************************//**
+ * Initializes a view of sh sorted with ptr_func_sort. The view starts
+ * dirty, so the first ops_sorted_view_get sorts the table.
+ ***************************************************************************/
+extern void ops_sorted_view_init(struct ops_sorted_view *view,
+                                 const struct shash *sh,
+                                 void *ptr_func_sort);
+
+/************************************************************************//**
+ * Frees the memory of a view. The shash is not touched.
+ ***************************************************************************/
+extern void ops_sorted_view_destroy(struct ops_sorted_view *view);
+
+/************************************************************************//**
+ * Marks a view for a full re-sort on the next ops_sorted_view_get.
+ ***************************************************************************/
+extern void ops_sorted_view_invalidate(struct ops_sorted_view *view);
+
+/************************************************************************//**
+ * Marks a view for a full re-sort if seqno differs from the one of the
+ * previous call, e.g. with ovsdb_idl_get_seqno for a shash built from
+ * database rows.
+ ***************************************************************************/
+extern void ops_sorted_view_set_seqno(struct ops_sorted_view *view,
+                                      unsigned int seqno);
+
+/************************************************************************//**
+ * Adds a node, already added to the shash, in its sorted position.
+ ***************************************************************************/
+extern void ops_sorted_view_insert(struct ops_sorted_view *view,
+                                   const struct shash_node *node);
+
+/************************************************************************//**
+ * Removes a node from its sorted position. Must be called before the node
+ * is deleted from the shash, since the comparator still reads it.
+ *
+ * @return true if the node was found or the view is dirty, else false
+ ***************************************************************************/
+extern bool ops_sorted_view_remove(struct ops_sorted_view *view,
+                                   const struct shash_node *node);
+
+/************************************************************************//**
+ * Gets the sorted nodes, re-sorting them only if the view is dirty.
+ *
+ * @param[in,out] view : sorted view
+ * @param[out]    n    : number of nodes
+ *
+ * @return sorted nodes, valid until the view is next changed
+ ***************************************************************************/
+extern const struct shash_node **
+ops_sorted_view_get(struct ops_sorted_view *view, size_t *n);
+
+/************************************************************************//**
+ * Gets the first k nodes of a shash in ops_sort order, or the first k
+ * nodes after a cursor, without sorting the whole table. A bounded heap
+ * keeps the best k candidates seen, for O(n log k).
+ *
+ * For paging, pass the last node of the previous page as after. A node
+ * only known by name can be passed as a struct shash_node on the stack
+ * with the members the comparator reads filled in. The comparator must be
+ * a total order, nodes comparing equal to after are skipped.
+ *
+ * @param[in]  sh            : shash containing unsorted elements
+ * @param[in]  ptr_func_sort : comparator, as for ops_sort
+ * @param[in]  after         : cursor, NULL to start from the beginning
+ * @param[in]  k             : maximum number of nodes to return
+ * @param[out] sorted_list   : array of k entries allocated by the caller
+ * @param[out] n             : number of nodes stored in sorted_list
+ *
+ * @return zero for success, else non-zero on failure
+ ***************************************************************************/
+extern int ops_sort_top_k(const struct shash *sh, void *ptr_func_sort,
+                          const struct shash_node *after, size_t k,
+                          const struct shash_node **sorted_list, size_t *n);
+
+/* Tables smaller than this are sorted serially by ops_sort_parallel */
+#define OPS_SORT_PARALLEL_MIN          65536
+/* Upper bound on the threads used by ops_sort_parallel */
+#define OPS_SORT_PARALLEL_MAX_THREADS  16
+
+/************************************************************************//**
+ * Multi-threaded version of ops_sort for very large tables.
+ *
+ * The nodes are split in one chunk per thread and the chunks sorted
+ * concurrently with qsort. Sorted runs are then merged pairwise, each merge
+ * split between the threads along its merge path so that all threads stay
+ * busy down to the last merge. The threads are started once per call and
+ * handed each phase in turn. Tables below OPS_SORT_PARALLEL_MIN are
+ * sorted serially. The result is the same as ops_sort's for comparators
+ * that are total orders, nodes comparing equal may come out in another
+ * order, as they may with qsort.
+ *
+ * @param[in]  sh            : shash containing unsorted elements
+ * @param[in]  ptr_func_sort : comparator, as for ops_sort, called from
+ *                             several threads at once
+ * @param[out] sorted_list   : array of shash_count(sh) entries allocated
+ *                             by the caller
+ * @param[in]  n_threads     : threads to use including the caller, 0 for
+ *                             one per online CPU, at most
+ *                             OPS_SORT_PARALLEL_MAX_THREADS
+ *
+ * @return zero for success, else non-zero on failure
+ ***************************************************************************/
+extern int ops_sort_parallel(const struct shash *sh, void *ptr_func_sort,
+                             const struct shash_node **sorted_list,
+                             unsigned int n_threads);
+
+#endif /* __SORT_UTILS_H_ */
+/** @} end of group sort_utils_public */
+/** @} end of group sort_utils */
@@ -0,0 +1,215 @@
+/*
+ Copyright (C) 2016 Hewlett-Packard Development Company, L.P.
+ All Rights Reserved.
+
+    Licensed under the Apache License, Version 2.0 (the "License"); you may
+    not use this file except in compliance with the License. You may obtain
+    a copy of the License at
+
+         http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+    WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+    License for the specific language governing permissions and limitations
+    under the License.
+*/
+
+/************************************************************************//**
+ * @defgroup vlan_bitmap Core Utilities
+ * This library provides common utility functions used by various OpenSwitch
+ * processes.
+ * @{
+ *
+ * @defgroup vlan_bitmap_public Public Interface
+ * Public API for vlan_bitmap library.
+ *
+ * A fixed size set of 802.1Q VLAN ids, with range parsing and set algebra.
+ * On x86-64 the set operations and counting use SSE2, AVX2 and POPCNT
+ * kernels chosen at run time, elsewhere portable 64-bit word loops.
+ *
+ * @{
+ *
+ * @file
+ * Header for vlan_bitmap library.
+ ***************************************************************************/
+
+#ifndef __VLAN_BITMAP_H_
+#define __VLAN_BITMAP_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define OPS_VLAN_ID_COUNT      4096  /*!< Number of 802.1Q VLAN ids */
+#define OPS_VLAN_ID_MIN        1     /*!< Lowest configurable VLAN id */
+#define OPS_VLAN_ID_MAX        4094  /*!< Highest configurable VLAN id */
+
+#define OPS_VLAN_BITMAP_WORDS  (OPS_VLAN_ID_COUNT / 64)
+
+/* Set of VLAN ids, one bit per id (512 bytes) */
+struct ops_vlan_bitmap {
+    uint64_t words[OPS_VLAN_BITMAP_WORDS];
+};
+
+/* Iterates VID over the ids set in BITMAP, in ascending order */
+#define OPS_VLAN_BITMAP_FOR_EACH(VID, BITMAP)                           \
+    for ((VID) = ops_vlan_bitmap_next((BITMAP), 0);                     \
+         (VID) < OPS_VLAN_ID_COUNT;                                     \
+         (VID) = ops_vlan_bitmap_next((BITMAP), (VID) + 1))
+
+/************************************************************************//**
+ * Adds a VLAN id to the set.
+ *
+ * @param[in,out] bitmap : VLAN set
+ * @param[in]     vid    : VLAN id, 0 to OPS_VLAN_ID_COUNT - 1
+ ***************************************************************************/
+static inline void
+ops_vlan_bitmap_set(struct ops_vlan_bitmap *bitmap, unsigned int vid)
+{
+    bitmap->words[vid / 64] |= (uint64_t) 1 << (vid % 64);
+}
+
+/************************************************************************//**
+ * Removes a VLAN id from the set.
+ *
+ * @param[in,out] bitmap : VLAN set
+ * @param[in]     vid    : VLAN id, 0 to OPS_VLAN_ID_COUNT - 1
+ ***************************************************************************/
+static inline void
+ops_vlan_bitmap_clear(struct ops_vlan_bitmap *bitmap, unsigned int vid)
+{
+    bitmap->words[vid / 64] &= ~((uint64_t) 1 << (vid % 64));
+}
+
+/************************************************************************//**
+ * Checks if a VLAN id is in the set.
+ *
+ * @param[in]  bitmap : VLAN set
+ * @param[in]  vid    : VLAN id, 0 to OPS_VLAN_ID_COUNT - 1
+ *
+ * @return true if vid is in the set, else false
+ ***************************************************************************/
+static inline bool
+ops_vlan_bitmap_is_set(const struct ops_vlan_bitmap *bitmap, unsigned int vid)
+{
+    return (bitmap->words[vid / 64] >> (vid % 64)) & 1;
+}
+
+/************************************************************************//**
+ * Empties the set.
+ *
+ * @param[out] bitmap : VLAN set
+ ***************************************************************************/
+extern void ops_vlan_bitmap_init(struct ops_vlan_bitmap *bitmap);
+
+/************************************************************************//**
+ * Adds the VLAN ids first to last, inclusive, to the set.
+ *
+ * @param[in,out] bitmap : VLAN set
+ * @param[in]     first  : First VLAN id of the range
+ * @param[in]     last   : Last VLAN id of the range
+ ***************************************************************************/
+extern void ops_vlan_bitmap_set_range(struct ops_vlan_bitmap *bitmap,
+                                      unsigned int first, unsigned int last);
+
+/************************************************************************//**
+ * Parses a VLAN list such as "1-1000,2000-2100,3000" into a set. Ids must
+ * be between OPS_VLAN_ID_MIN and OPS_VLAN_ID_MAX.
+ *
+ * @param[out] bitmap : VLAN set, only valid on success
+ * @param[in]  str    : Comma separated list of VLAN ids and ranges
+ *
+ * @return true if str is a valid VLAN list, else false
+ ***************************************************************************/
+extern bool ops_vlan_bitmap_parse(struct ops_vlan_bitmap *bitmap,
+                                  const char *str);
+
+/************************************************************************//**
+ * Computes dst = a | b. dst may be the same as a or b.
+ ***************************************************************************/
+extern void ops_vlan_bitmap_union(struct ops_vlan_bitmap *dst,
+                                  const struct ops_vlan_bitmap *a,
+                                  const struct ops_vlan_bitmap *b);
+
+/************************************************************************//**
+ * Computes dst = a & b. dst may be the same as a or b.
+ ***************************************************************************/
+extern void ops_vlan_bitmap_intersect(struct ops_vlan_bitmap *dst,
+                                      const struct ops_vlan_bitmap *a,
+                                      const struct ops_vlan_bitmap *b);
+
+/************************************************************************//**
+ * Computes dst = a & ~b, the ids in a that are not in b. dst may be the
+ * same as a or b.
+ ***************************************************************************/
+extern void ops_vlan_bitmap_difference(struct ops_vlan_bitmap *dst,
+                                       const struct ops_vlan_bitmap *a,
+                                       const struct ops_vlan_bitmap *b);
+
+/************************************************************************//**
+ * Computes the union of n sets, e.g. the VLANs used by a group of ports.
+ * dst may be one of the inputs. An empty input list gives an empty set.
+ ***************************************************************************/
+extern void ops_vlan_bitmap_union_many(
+    struct ops_vlan_bitmap *dst, const struct ops_vlan_bitmap *const *bitmaps,
+    size_t n);
+
+/************************************************************************//**
+ * Computes the intersection of n sets, e.g. the VLANs common to all members
+ * of a LAG. dst may be one of the inputs. An empty input list gives an
+ * empty set.
+ ***************************************************************************/
+extern void ops_vlan_bitmap_intersect_many(
+    struct ops_vlan_bitmap *dst, const struct ops_vlan_bitmap *const *bitmaps,
+    size_t n);
+
+/************************************************************************//**
+ * Checks if two sets hold the same VLAN ids.
+ *
+ * @return true if a and b are equal, else false
+ ***************************************************************************/
+extern bool ops_vlan_bitmap_equal(const struct ops_vlan_bitmap *a,
+                                  const struct ops_vlan_bitmap *b);
+
+/************************************************************************//**
+ * Checks if the set is empty.
+ *
+ * @return true if bitmap holds no VLAN id, else false
+ ***************************************************************************/
+extern bool ops_vlan_bitmap_is_empty(const struct ops_vlan_bitmap *bitmap);
+
+/************************************************************************//**
+ * Counts the VLAN ids in the set.
+ *
+ * @return number of VLAN ids in bitmap
+ ***************************************************************************/
+extern size_t ops_vlan_bitmap_count(const struct ops_vlan_bitmap *bitmap);
+
+/************************************************************************//**
+ * Lists the VLAN ids in the set in ascending order, in the form taken by
+ * ops_port_set_trunks.
+ *
+ * @param[in]  bitmap : VLAN set
+ * @param[out] ids    : Array of at least ops_vlan_bitmap_count(bitmap)
+ *                      entries
+ *
+ * @return number of VLAN ids stored in ids
+ ***************************************************************************/
+extern size_t ops_vlan_bitmap_to_array(const struct ops_vlan_bitmap *bitmap,
+                                       int64_t *ids);
+
+/************************************************************************//**
+ * Finds the lowest VLAN id in the set that is not below start.
+ *
+ * @param[in]  bitmap : VLAN set
+ * @param[in]  start  : VLAN id to start searching from
+ *
+ * @return VLAN id, or OPS_VLAN_ID_COUNT if there is none
+ ***************************************************************************/
+extern unsigned int ops_vlan_bitmap_next(const struct ops_vlan_bitmap *bitmap,
+                                         unsigned int start);
+
+#endif /* __VLAN_BITMAP_H_ */
+/** @} end of group vlan_bitmap_public */
+/** @} end of group vlan_bitmap */
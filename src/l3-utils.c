@@ -31,59 +31,248 @@
 #include <string.h>
 #include <errno.h>
 #include <byteswap.h>
+#include <endian.h>
 
 #include <assert.h>
+#include "util.h"
+#include "hmap.h"
+#include "uuid.h"
 #include "vrf-utils.h"
 #include "l3-utils.h"
 
+/*********************************************************
+ *                    Prefix parsing                     *
+ *********************************************************/
+
+/* Returns the decimal value of c, or a value >= 10 if c is not a digit */
+static inline unsigned int
+l3_utils_dec_digit (char c)
+{
+    return (unsigned int) (c - '0');
+}
+
+/* Returns the hexadecimal value of c, or -1 if c is not a hex digit */
+static inline int
+l3_utils_hex_digit (char c)
+{
+    if (l3_utils_dec_digit(c) < 10) {
+        return c - '0';
+    }
+    c |= 0x20;
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+/*
+ * Parses the dotted quad starting at p into 4 octets in network byte order.
+ * Returns a pointer to the first character after the address, or NULL if
+ * p does not start with a valid dotted quad. Like inet_pton(), octets with
+ * leading zeros are rejected.
+ */
+static const char *
+l3_utils_parse_ipv4_octets (const char *p, uint8_t *octets)
+{
+    unsigned int val;
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        if (i && *p++ != '.') {
+            return NULL;
+        }
+        if ((val = l3_utils_dec_digit(*p++)) >= 10) {
+            return NULL;
+        }
+        if (val == 0 && l3_utils_dec_digit(*p) < 10) {
+            return NULL;
+        }
+        while (l3_utils_dec_digit(*p) < 10) {
+            val = val * 10 + l3_utils_dec_digit(*p++);
+            if (val > 255) {
+                return NULL;
+            }
+        }
+        octets[i] = val;
+    }
+    return p;
+}
+
 /*
- * Function extracts and returns the subnet mask bits from ip_addr
- * Parameter 1 : IPv4 address
+ * Parses the IPv6 address starting at p into 16 octets in network byte
+ * order, following the same rules as inet_pton(). Parsing stops at the
+ * first character that cannot be part of the address. Returns a pointer
+ * to that character, or NULL if the address is invalid.
  */
-static unsigned int
-l3_utils_mask_bits (const char *ip_addr, u_char family)
+static const char *
+l3_utils_parse_ipv6_octets (const char *p, uint8_t *octets)
 {
-    unsigned int mask_bits = 0;
-    char *p;
+    uint8_t *tp = octets;
+    uint8_t *endp = octets + sizeof(struct in6_addr);
+    uint8_t *colonp = NULL;
+    const char *curtok;
+    unsigned int val = 0;
+    int digits = 0;
+    int x;
 
-    if ((p = strchr(ip_addr, '/'))) {
-        mask_bits = atoi(p + 1);
+    memset(octets, 0, sizeof(struct in6_addr));
+
+    /* Leading ':' is only valid as part of '::' */
+    if (*p == ':' && *++p != ':') {
+        return NULL;
     }
-    /* If '/' is not present in ip_addr, it assumed its host address */
-    else {
-        if (family == AF_INET) {
-            mask_bits = IPV4_BITLENGTH_MAX;
+    curtok = p;
+
+    for (;; p++) {
+        if ((x = l3_utils_hex_digit(*p)) >= 0) {
+            if (++digits > 4) {
+                return NULL;
+            }
+            val = (val << 4) | x;
+            continue;
+        }
+        if (*p == ':') {
+            curtok = p + 1;
+            if (!digits) {
+                if (colonp) {
+                    return NULL;
+                }
+                colonp = tp;
+                continue;
+            }
+            if (p[1] == '\0' || p[1] == '/' || tp + 2 > endp) {
+                return NULL;
+            }
+            *tp++ = (uint8_t) (val >> 8);
+            *tp++ = (uint8_t) val;
+            digits = 0;
+            val = 0;
+            continue;
+        }
+        if (*p == '.' && tp + 4 <= endp) {
+            /* Trailing dotted quad, reparse the current group as decimal */
+            if (!(p = l3_utils_parse_ipv4_octets(curtok, tp))) {
+                return NULL;
+            }
+            tp += 4;
+            digits = 0;
+        }
+        break;
+    }
+
+    if (digits) {
+        if (tp + 2 > endp) {
+            return NULL;
         }
-        else if (family == AF_INET6) {
-            mask_bits = IPV6_BITLENGTH_MAX;
+        *tp++ = (uint8_t) (val >> 8);
+        *tp++ = (uint8_t) val;
+    }
+    if (colonp) {
+        /* Shift the groups after '::' to the end of the address */
+        size_t n = tp - colonp;
+
+        if (tp == endp) {
+            return NULL;
         }
+        memmove(endp - n, colonp, n);
+        memset(colonp, 0, endp - n - colonp);
+        tp = endp;
     }
-    return mask_bits;
+    if (tp != endp) {
+        return NULL;
+    }
+    return p;
 }
 
 /*
- * This function returns the IP address part of the input IPv4
- * address without subnet mask bits.
- * Parameter 1 : IPv4 address
+ * Parses the optional "/len" suffix at p. A missing suffix yields max_len.
+ * Returns false if the suffix is malformed, out of range, or followed by
+ * anything other than the end of the string.
  */
-static uint32_t
-l3_utils_ipv4_address (const char* ip_addr)
+static bool
+l3_utils_parse_prefix_len (const char *p, unsigned int max_len,
+                           u_char *prefix_len)
 {
-    char ipAddressString[IP_ADDRESS_LENGTH + 1];
-    uint32_t  addr = 0;
-    char *p;
+    unsigned int len = 0;
+    int digits = 0;
 
-    strncpy(ipAddressString, ip_addr, IP_ADDRESS_LENGTH + 1);
-    if (NULL != (p = (strchr(ipAddressString, '/')))) {
-        *p = '\0';
+    if (*p == '\0') {
+        *prefix_len = max_len;
+        return true;
+    }
+    if (*p++ != '/') {
+        return false;
+    }
+    while (l3_utils_dec_digit(*p) < 10) {
+        if (++digits > 3) {
+            return false;
+        }
+        len = len * 10 + l3_utils_dec_digit(*p++);
+    }
+    if (!digits || *p != '\0' || len > max_len) {
+        return false;
     }
+    *prefix_len = len;
+    return true;
+}
 
-    inet_pton(AF_INET, ipAddressString, &addr);
-    addr = htonl(addr);
+static inline bool
+l3_utils_parse_prefix__ (const char *str, u_char family,
+                         struct l3_utils_prefix *prefix)
+{
+    const char *p;
 
-    return addr;
+    if (family == AF_INET || family == AF_UNSPEC) {
+        p = l3_utils_parse_ipv4_octets(str, (uint8_t *) &prefix->addr.ipv4);
+        if (p && l3_utils_parse_prefix_len(p, IPV4_BITLENGTH_MAX,
+                                           &prefix->prefix_len)) {
+            prefix->family = AF_INET;
+            return true;
+        }
+    }
+    if (family == AF_INET6 || family == AF_UNSPEC) {
+        p = l3_utils_parse_ipv6_octets(str, prefix->addr.ipv6.s6_addr);
+        if (p && l3_utils_parse_prefix_len(p, IPV6_BITLENGTH_MAX,
+                                           &prefix->prefix_len)) {
+            prefix->family = AF_INET6;
+            return true;
+        }
+    }
+    prefix->family = AF_UNSPEC;
+    return false;
 }
 
+/*
+ * Parses an IPv4/IPv6 address with optional prefix length into its
+ * binary form. Returns true on success.
+ */
+bool
+l3_utils_parse_prefix (const char *str, u_char family,
+                       struct l3_utils_prefix *prefix)
+{
+    return l3_utils_parse_prefix__(str, family, prefix);
+}
+
+/*
+ * Parses an array of address strings. Returns the number of strings
+ * that were valid; invalid entries are marked with AF_UNSPEC.
+ */
+size_t
+l3_utils_parse_prefixes (const char *const *strs, size_t n, u_char family,
+                         struct l3_utils_prefix *prefixes)
+{
+    size_t i, n_valid = 0;
+
+    for (i = 0; i < n; i++) {
+        n_valid += l3_utils_parse_prefix__(strs[i], family, &prefixes[i]);
+    }
+    return n_valid;
+}
+
+/*********************************************************
+ *                    Overlap checking                   *
+ *********************************************************/
+
 /* Represents IPv6 address split into 2 64 bit integers */
 struct split_ipv6_addr
 {
@@ -100,7 +289,8 @@ struct split_ipv6_addr
  * Parameter 3 : Subnet mask bits.
  */
 static void
-l3_utils_mask_ipv6_addr (unsigned char *masked_addr, unsigned char *ipv6_addr,
+l3_utils_mask_ipv6_addr (unsigned char *masked_addr,
+                         const unsigned char *ipv6_addr,
                          unsigned int mask_bits)
 {
     struct split_ipv6_addr parts;
@@ -108,6 +298,9 @@ l3_utils_mask_ipv6_addr (unsigned char *masked_addr, unsigned char *ipv6_addr,
     unsigned char *p = masked_addr;
 
     memset(masked_addr, 0, sizeof(struct in6_addr));
+    if (mask_bits == 0) {
+        return;
+    }
     memcpy(&parts, ipv6_addr, sizeof(parts));
 
     if (mask_bits <= 64) {
@@ -127,31 +320,66 @@ l3_utils_mask_ipv6_addr (unsigned char *masked_addr, unsigned char *ipv6_addr,
 }
 
 /*
- * This function mask subnet from the entered IPv6 address
- * using subnet bits.
- * Parameter 1 : IPv6 address
- * Parameter 2 : subnet addr contains masked IPv6 address
- * Parameter 3 : Subnet mask bits.
+ * Returns the IPv4 subnet mask in host byte order for mask_bits.
  */
-static void
-l3_utils_ipv6_subnet (const char* ip_addr, char *subnet_addr,
-                      unsigned int mask_bits)
+static inline uint32_t
+l3_utils_ipv4_mask (unsigned int mask_bits)
 {
-    char ipAddressString[IPV6_ADDRESS_LENGTH + 1];
-    unsigned char ipv6_addr[sizeof(struct in6_addr)];
-    unsigned char masked_addr[sizeof(struct in6_addr)];
-    char *p;
+    return mask_bits ? IPV4_SUBNET_MASK_FULL <<
+                       (IPV4_ADDR_BIT_LENGTH - mask_bits) : 0;
+}
+
+/*
+ * Checks if two prefixes of the same family have the same network
+ * address when masked with the shorter of the two prefix lengths.
+ */
+static bool
+l3_utils_prefix_overlaps (const struct l3_utils_prefix *a,
+                          const struct l3_utils_prefix *b)
+{
+    unsigned char a_subnet[sizeof(struct in6_addr)];
+    unsigned char b_subnet[sizeof(struct in6_addr)];
+    unsigned int mask_bits;
+    uint32_t mask;
 
-    strncpy(ipAddressString, ip_addr, IPV6_ADDRESS_LENGTH + 1);
-    if (NULL != (p = (strchr(ipAddressString, '/')))) {
-        *p = '\0';
+    mask_bits = a->prefix_len < b->prefix_len ? a->prefix_len : b->prefix_len;
+    if (a->family == AF_INET) {
+        mask = l3_utils_ipv4_mask(mask_bits);
+        return (ntohl(a->addr.ipv4.s_addr) & mask) ==
+               (ntohl(b->addr.ipv4.s_addr) & mask);
     }
+    l3_utils_mask_ipv6_addr(a_subnet, a->addr.ipv6.s6_addr, mask_bits);
+    l3_utils_mask_ipv6_addr(b_subnet, b->addr.ipv6.s6_addr, mask_bits);
+    return !memcmp(a_subnet, b_subnet, sizeof(a_subnet));
+}
 
-    inet_pton(AF_INET6, ipAddressString, ipv6_addr);
-    l3_utils_mask_ipv6_addr(masked_addr, ipv6_addr, mask_bits);
-    inet_ntop(AF_INET6, masked_addr, subnet_addr, INET6_ADDRSTRLEN);
+/*
+ * Returns the primary and secondary address columns of port_row for the
+ * given address family.
+ */
+static void
+l3_utils_port_addresses (const struct ovsrec_port *port_row, u_char family,
+                         char **primary, char ***secondaries,
+                         size_t *n_secondaries)
+{
+    if (family == AF_INET6) {
+        *primary = port_row->ip6_address;
+        *secondaries = port_row->ip6_address_secondary;
+        *n_secondaries = port_row->n_ip6_address_secondary;
+    }
+    else {
+        *primary = port_row->ip4_address;
+        *secondaries = port_row->ip4_address_secondary;
+        *n_secondaries = port_row->n_ip4_address_secondary;
+    }
+    if (*secondaries == NULL) {
+        *n_secondaries = 0;
+    }
 }
 
+static const struct l3_utils_addr_filter *
+l3_utils_vrf_filter (const struct ovsrec_vrf *vrf_row, bool build_uncommitted);
+
 /*
  * Checks if IPv4/IPv6 address already configured as primary/secondary
  * IPv4/IPv6 address for any other interface.
@@ -167,112 +395,915 @@ l3_utils_is_ipaddr_overlapping (const char *ip_address,
 {
     size_t i, n;
     const struct ovsrec_port *port_row = NULL;
-    char input_ipv6_subnet[INET6_ADDRSTRLEN];
-    char port_ipv6_subnet[INET6_ADDRSTRLEN];
-    uint32_t input_ipv4_addr = 0, port_ipv4_addr = 0, mask = 0;
-    unsigned int input_mask_bits = 0, port_mask_bits = 0, mask_bits = 0;
+    const struct l3_utils_addr_filter *filter;
+    struct l3_utils_prefix input_prefix, port_prefix;
+    char *primary_address;
+    char **secondary_addresses;
+    size_t n_secondary_addresses;
 
+    if ((addr_family != AF_INET && addr_family != AF_INET6) ||
+        !l3_utils_parse_prefix(ip_address, addr_family, &input_prefix)) {
+        return false;
+    }
+
+    /* Most addresses overlap nothing, which the VRF's filter tells without
+     * parsing every port address. Ports changed in the caller's open
+     * transaction are only seen by the walk below. */
+    filter = l3_utils_vrf_filter(vrf_row, false);
+    if ((filter != NULL) &&
+        !l3_utils_addr_filter_may_overlap(filter, &input_prefix)) {
+        return false;
+    }
 
-    input_mask_bits = l3_utils_mask_bits(ip_address, addr_family);
     for (i = 0; i < vrf_row->n_ports; i++) {
         port_row = vrf_row->ports[i];
-        if (addr_family == AF_INET6) {
-            /* Checks if the IP is configured as primary */
-            if (port_row->ip6_address != NULL ) {
-                port_mask_bits = l3_utils_mask_bits(port_row->ip6_address,
-                                                    addr_family);
-                mask_bits = input_mask_bits < port_mask_bits ?
-                            input_mask_bits : port_mask_bits;
-                l3_utils_ipv6_subnet(ip_address, input_ipv6_subnet, mask_bits);
-                l3_utils_ipv6_subnet(port_row->ip6_address, port_ipv6_subnet,
-                                     mask_bits);
-                /* Compares if 2 IPv6 subnet mask are same */
-                if (!strncmp(input_ipv6_subnet, port_ipv6_subnet,
-                             INET6_ADDRSTRLEN)) {
-                    if (strncmp(port_row->name, if_name, strlen(if_name)) == 0) {
-                        /* If input IP is secondary IP and matched with
-                           primary IP, IP cannot be configured. Return true */
-                        if (secondary) {
-                           return true;
-                        }
-                        return false;
-                    }
-                    /* If same as another interface IP address, return true */
-                    else {
-                        return true;
-                    }
+        l3_utils_port_addresses(port_row, addr_family, &primary_address,
+                                &secondary_addresses, &n_secondary_addresses);
+
+        /* Checks if the IP is configured as primary */
+        if (primary_address != NULL &&
+            l3_utils_parse_prefix(primary_address, addr_family, &port_prefix) &&
+            l3_utils_prefix_overlaps(&input_prefix, &port_prefix)) {
+            /* If IP is same and same interface, then can be confgured
+               if input is primary, else cannot be configured. */
+            if (strncmp(port_row->name, if_name, strlen(if_name)) == 0) {
+                if (secondary) {
+                   return true;
                 }
+                return false;
             }
-            /* Loop through secondary addresses to check if any IP matches */
-            if (port_row->ip6_address_secondary != NULL ) {
-                for (n = 0; n < port_row->n_ip6_address_secondary; n++) {
-                    port_mask_bits =
-                        l3_utils_mask_bits(port_row->ip6_address_secondary[n],
-                                           addr_family);
-                    mask_bits = input_mask_bits < port_mask_bits ?
-                                input_mask_bits : port_mask_bits;
-                    l3_utils_ipv6_subnet(ip_address, input_ipv6_subnet,
-                                         mask_bits);
-                    l3_utils_ipv6_subnet(port_row->ip6_address_secondary[n],
-                                         port_ipv6_subnet, mask_bits);
-
-                    /* Checks if the IP is configured as secondary */
-                    if (!strncmp(input_ipv6_subnet, port_ipv6_subnet,
-                                 INET6_ADDRSTRLEN)) {
-                        return true;
-                    }
-                }
+            /* If same as another interface IP address, return true */
+            else {
+                return true;
             }
         }
-        else if (addr_family == AF_INET) {
-
-            input_ipv4_addr = l3_utils_ipv4_address(ip_address);
-
-            if (port_row->ip4_address != NULL ) {
-                port_ipv4_addr = l3_utils_ipv4_address(port_row->ip4_address);
-                port_mask_bits = l3_utils_mask_bits(port_row->ip4_address,
-                                                    addr_family);
-                mask_bits = input_mask_bits < port_mask_bits ?
-                            input_mask_bits : port_mask_bits;
-                mask = (IPV4_SUBNET_MASK_FULL <<
-                       (IPV4_ADDR_BIT_LENGTH - mask_bits));
-
-                /* Checks if IP is same as primary IP */
-                if ((input_ipv4_addr & mask) == (port_ipv4_addr & mask)) {
-                    /* If IP is same and same interface, then can be confgured
-                       if input is primary, else cannot be configured. */
-                    if (strncmp(port_row->name, if_name, strlen(if_name))
-                        == 0) {
-                        if (secondary) {
-                           return true;
-                        }
-                        return false;
-                    }
-                    /* Checks if IP is same as primary IP of other interface */
-                    else {
-                        return true;
-                    }
-                }
+
+        /* Loop through secondary addresses to check if any IP matches */
+        for (n = 0; n < n_secondary_addresses; n++) {
+            if (l3_utils_parse_prefix(secondary_addresses[n], addr_family,
+                                      &port_prefix) &&
+                l3_utils_prefix_overlaps(&input_prefix, &port_prefix)) {
+                return true;
             }
-            if (port_row->ip4_address_secondary != NULL ) {
-                /* Loops through all the secondary addresses */
-                for (n = 0; n < port_row->n_ip4_address_secondary; n++) {
-                    port_ipv4_addr =
-                     l3_utils_ipv4_address(port_row->ip4_address_secondary[n]);
-                    port_mask_bits =
-                       l3_utils_mask_bits (port_row->ip4_address_secondary[n],
-                                           addr_family);
-                    mask_bits = input_mask_bits < port_mask_bits ?
-                                input_mask_bits : port_mask_bits;
-                    mask = (IPV4_SUBNET_MASK_FULL <<
-                           (IPV4_ADDR_BIT_LENGTH - mask_bits));
-                    /* Checks if any secondary IP address matches */
-                    if ((input_ipv4_addr & mask) == (port_ipv4_addr & mask)) {
-                        return true;
-                    }
+        }
+    }
+    return false;
+}
+
+/*********************************************************
+ *                  Prefix aggregation                   *
+ *********************************************************/
+
+/*
+ * Clears the host bits of prefix, leaving only its network address.
+ */
+static void
+l3_utils_prefix_apply_mask (struct l3_utils_prefix *prefix)
+{
+    unsigned char masked_addr[sizeof(struct in6_addr)];
+
+    if (prefix->family == AF_INET) {
+        prefix->addr.ipv4.s_addr =
+            htonl(ntohl(prefix->addr.ipv4.s_addr) &
+                  l3_utils_ipv4_mask(prefix->prefix_len));
+    }
+    else {
+        l3_utils_mask_ipv6_addr(masked_addr, prefix->addr.ipv6.s6_addr,
+                                prefix->prefix_len);
+        memcpy(prefix->addr.ipv6.s6_addr, masked_addr, sizeof(masked_addr));
+    }
+}
+
+/*
+ * Checks if outer covers the whole of inner.
+ */
+static inline bool
+l3_utils_prefix_contains (const struct l3_utils_prefix *outer,
+                          const struct l3_utils_prefix *inner)
+{
+    return outer->family == inner->family &&
+           outer->prefix_len <= inner->prefix_len &&
+           l3_utils_prefix_overlaps(outer, inner);
+}
+
+/*
+ * Checks if a and b are the two halves of the same parent prefix.
+ * a must not contain b.
+ */
+static inline bool
+l3_utils_prefix_is_sibling (const struct l3_utils_prefix *a,
+                            const struct l3_utils_prefix *b)
+{
+    struct l3_utils_prefix parent;
+
+    if (a->family != b->family || a->prefix_len != b->prefix_len ||
+        a->prefix_len == 0) {
+        return false;
+    }
+    parent = *a;
+    parent.prefix_len--;
+    return l3_utils_prefix_overlaps(&parent, b);
+}
+
+/*
+ * qsort() comparator ordering prefixes by family, then network address,
+ * then prefix length. Network byte order compares correctly with memcmp.
+ */
+static int
+l3_utils_prefix_cmp (const void *a_, const void *b_)
+{
+    const struct l3_utils_prefix *a = a_;
+    const struct l3_utils_prefix *b = b_;
+    int cmp;
+
+    if (a->family != b->family) {
+        return a->family < b->family ? -1 : 1;
+    }
+    cmp = memcmp(&a->addr, &b->addr, a->family == AF_INET ?
+                 sizeof(struct in_addr) : sizeof(struct in6_addr));
+    if (cmp) {
+        return cmp;
+    }
+    return (int) a->prefix_len - (int) b->prefix_len;
+}
+
+/*
+ * Replaces prefixes with the minimal set of prefixes covering the same
+ * address space. After sorting, a single pass keeps a stack of disjoint
+ * prefixes in the front of the array: a prefix covered by the top of the
+ * stack is dropped, and the top two entries are merged into their parent
+ * for as long as they are siblings.
+ */
+size_t
+l3_utils_aggregate_prefixes (struct l3_utils_prefix *prefixes, size_t n)
+{
+    size_t i, top = 0;
+
+    for (i = 0; i < n; i++) {
+        l3_utils_prefix_apply_mask(&prefixes[i]);
+    }
+    qsort(prefixes, n, sizeof *prefixes, l3_utils_prefix_cmp);
+
+    for (i = 0; i < n; i++) {
+        if (top && l3_utils_prefix_contains(&prefixes[top - 1],
+                                            &prefixes[i])) {
+            continue;
+        }
+        prefixes[top++] = prefixes[i];
+        while (top >= 2 && l3_utils_prefix_is_sibling(&prefixes[top - 2],
+                                                      &prefixes[top - 1])) {
+            top--;
+            prefixes[top - 1].prefix_len--;
+        }
+    }
+    return top;
+}
+
+/*
+ * Collects the connected subnets of all ports in vrf_row for the given
+ * family (AF_UNSPEC for both). The returned array must be freed by the
+ * caller.
+ */
+size_t
+l3_utils_vrf_get_prefixes (const struct ovsrec_vrf *vrf_row, u_char family,
+                           struct l3_utils_prefix **prefixes)
+{
+    static const u_char families[] = { AF_INET, AF_INET6 };
+    const struct ovsrec_port *port_row;
+    char *primary;
+    char **secondaries;
+    size_t n_secondaries, n_max = 0, n = 0;
+    size_t i, j, k;
+
+    for (k = 0; k < ARRAY_SIZE(families); k++) {
+        if (family != AF_UNSPEC && family != families[k]) {
+            continue;
+        }
+        for (i = 0; i < vrf_row->n_ports; i++) {
+            l3_utils_port_addresses(vrf_row->ports[i], families[k], &primary,
+                                    &secondaries, &n_secondaries);
+            n_max += (primary != NULL) + n_secondaries;
+        }
+    }
+
+    *prefixes = xmalloc(n_max * sizeof **prefixes);
+    for (k = 0; k < ARRAY_SIZE(families); k++) {
+        if (family != AF_UNSPEC && family != families[k]) {
+            continue;
+        }
+        for (i = 0; i < vrf_row->n_ports; i++) {
+            port_row = vrf_row->ports[i];
+            l3_utils_port_addresses(port_row, families[k], &primary,
+                                    &secondaries, &n_secondaries);
+            if (primary != NULL &&
+                l3_utils_parse_prefix(primary, families[k], &(*prefixes)[n])) {
+                l3_utils_prefix_apply_mask(&(*prefixes)[n++]);
+            }
+            for (j = 0; j < n_secondaries; j++) {
+                if (l3_utils_parse_prefix(secondaries[j], families[k],
+                                          &(*prefixes)[n])) {
+                    l3_utils_prefix_apply_mask(&(*prefixes)[n++]);
                 }
             }
         }
     }
+    return n;
+}
+
+/*
+ * Returns the aggregated connected subnets of vrf_row. The returned array
+ * must be freed by the caller.
+ */
+size_t
+l3_utils_vrf_aggregate_prefixes (const struct ovsrec_vrf *vrf_row,
+                                 u_char family,
+                                 struct l3_utils_prefix **prefixes)
+{
+    size_t n;
+
+    n = l3_utils_vrf_get_prefixes(vrf_row, family, prefixes);
+    return l3_utils_aggregate_prefixes(*prefixes, n);
+}
+
+/*********************************************************
+ *                 Free subnet allocation                *
+ *********************************************************/
+
+/*
+ * Address as a 128 bit integer in host byte order. IPv4 addresses are
+ * left aligned in the upper 32 bits so that a prefix of length len covers
+ * 2^(128 - len) values for both families.
+ */
+struct l3_utils_u128 {
+    uint64_t hi;
+    uint64_t lo;
+};
+
+/* Occupied address range [first, last] inside a subnet pool */
+struct l3_utils_range {
+    struct l3_utils_u128 first;
+    struct l3_utils_u128 last;
+};
+
+struct l3_utils_subnet_pool {
+    struct l3_utils_prefix pool;       /* Pool subnets are carved from */
+    struct l3_utils_u128 pool_last;    /* Last address of the pool */
+    struct l3_utils_u128 cursor;       /* Lowest address not yet handed out */
+    bool exhausted;                    /* Cursor moved past the pool */
+    struct l3_utils_range *occupied;   /* Sorted, disjoint port subnets */
+    size_t n_occupied;
+    size_t next_occupied;              /* First range not below cursor */
+};
+
+static inline void
+l3_utils_prefix_to_u128 (const struct l3_utils_prefix *prefix,
+                         struct l3_utils_u128 *value)
+{
+    uint64_t part;
+
+    if (prefix->family == AF_INET) {
+        value->hi = (uint64_t) ntohl(prefix->addr.ipv4.s_addr) << 32;
+        value->lo = 0;
+        return;
+    }
+    memcpy(&part, &prefix->addr.ipv6.s6_addr[0], sizeof(part));
+    value->hi = be64toh(part);
+    memcpy(&part, &prefix->addr.ipv6.s6_addr[8], sizeof(part));
+    value->lo = be64toh(part);
+}
+
+static inline void
+l3_utils_u128_to_prefix (const struct l3_utils_u128 *value, u_char family,
+                         unsigned int prefix_len,
+                         struct l3_utils_prefix *prefix)
+{
+    uint64_t part;
+
+    prefix->family = family;
+    prefix->prefix_len = prefix_len;
+    if (family == AF_INET) {
+        prefix->addr.ipv4.s_addr = htonl((uint32_t) (value->hi >> 32));
+        return;
+    }
+    part = htobe64(value->hi);
+    memcpy(&prefix->addr.ipv6.s6_addr[0], &part, sizeof(part));
+    part = htobe64(value->lo);
+    memcpy(&prefix->addr.ipv6.s6_addr[8], &part, sizeof(part));
+}
+
+/* Returns the host part mask of a prefix of length prefix_len */
+static inline struct l3_utils_u128
+l3_utils_u128_hostmask (unsigned int prefix_len)
+{
+    struct l3_utils_u128 mask;
+
+    if (prefix_len < 64) {
+        mask.hi = UINT64_MAX >> prefix_len;
+        mask.lo = UINT64_MAX;
+    }
+    else {
+        mask.hi = 0;
+        mask.lo = prefix_len < 128 ? UINT64_MAX >> (prefix_len - 64) : 0;
+    }
+    return mask;
+}
+
+static inline int
+l3_utils_u128_cmp (const struct l3_utils_u128 *a,
+                   const struct l3_utils_u128 *b)
+{
+    if (a->hi != b->hi) {
+        return a->hi < b->hi ? -1 : 1;
+    }
+    if (a->lo != b->lo) {
+        return a->lo < b->lo ? -1 : 1;
+    }
+    return 0;
+}
+
+/* Returns the last address of the block of length prefix_len at value */
+static inline struct l3_utils_u128
+l3_utils_u128_block_last (const struct l3_utils_u128 *value,
+                          unsigned int prefix_len)
+{
+    struct l3_utils_u128 last = l3_utils_u128_hostmask(prefix_len);
+
+    last.hi |= value->hi;
+    last.lo |= value->lo;
+    return last;
+}
+
+/* Increments value, returning false if it wraps around */
+static inline bool
+l3_utils_u128_inc (struct l3_utils_u128 *value)
+{
+    if (++value->lo == 0) {
+        return ++value->hi != 0;
+    }
+    return true;
+}
+
+/*
+ * Advances the pool cursor past last. The cursor is kept in units of the
+ * smallest IPv4 or IPv6 address so that the pool is exhausted, rather
+ * than wrapped, at the end of the address space.
+ */
+static inline void
+l3_utils_subnet_pool_advance (struct l3_utils_subnet_pool *subnet_pool,
+                              const struct l3_utils_u128 *last)
+{
+    unsigned int max_len = subnet_pool->pool.family == AF_INET ?
+                           IPV4_BITLENGTH_MAX : IPV6_BITLENGTH_MAX;
+
+    subnet_pool->cursor = l3_utils_u128_block_last(last, max_len);
+    if (!l3_utils_u128_inc(&subnet_pool->cursor) ||
+        l3_utils_u128_cmp(&subnet_pool->cursor,
+                          &subnet_pool->pool_last) > 0) {
+        subnet_pool->exhausted = true;
+    }
+}
+
+/*
+ * Creates an allocator over the pool subnet that hands out blocks not
+ * overlapping any address configured on the ports of vrf_row.
+ */
+struct l3_utils_subnet_pool *
+l3_utils_subnet_pool_create (const struct ovsrec_vrf *vrf_row,
+                             const struct l3_utils_prefix *pool)
+{
+    struct l3_utils_subnet_pool *subnet_pool;
+    struct l3_utils_prefix *prefixes;
+    struct l3_utils_range range;
+    size_t i, n;
+
+    if (pool->family != AF_INET && pool->family != AF_INET6) {
+        return NULL;
+    }
+
+    subnet_pool = xzalloc(sizeof *subnet_pool);
+    subnet_pool->pool = *pool;
+    l3_utils_prefix_apply_mask(&subnet_pool->pool);
+    l3_utils_prefix_to_u128(&subnet_pool->pool, &subnet_pool->cursor);
+    subnet_pool->pool_last =
+        l3_utils_u128_block_last(&subnet_pool->cursor, pool->prefix_len);
+
+    /* Index the occupied space as sorted, disjoint ranges within the pool */
+    n = l3_utils_vrf_aggregate_prefixes(vrf_row, pool->family, &prefixes);
+    subnet_pool->occupied = xmalloc(n * sizeof *subnet_pool->occupied);
+    for (i = 0; i < n; i++) {
+        l3_utils_prefix_to_u128(&prefixes[i], &range.first);
+        range.last = l3_utils_u128_block_last(&range.first,
+                                              prefixes[i].prefix_len);
+        if (l3_utils_u128_cmp(&range.last, &subnet_pool->cursor) < 0 ||
+            l3_utils_u128_cmp(&range.first, &subnet_pool->pool_last) > 0) {
+            continue;
+        }
+        subnet_pool->occupied[subnet_pool->n_occupied++] = range;
+    }
+    free(prefixes);
+
+    return subnet_pool;
+}
+
+/*
+ * Allocates up to count free subnets of length prefix_len from the pool,
+ * in ascending address order. Returns the number of subnets allocated.
+ */
+size_t
+l3_utils_subnet_pool_alloc (struct l3_utils_subnet_pool *subnet_pool,
+                            unsigned int prefix_len, size_t count,
+                            struct l3_utils_prefix *subnets)
+{
+    struct l3_utils_u128 candidate, last, hostmask;
+    const struct l3_utils_range *range;
+    size_t n = 0;
+
+    if (prefix_len < subnet_pool->pool.prefix_len ||
+        prefix_len > (subnet_pool->pool.family == AF_INET ?
+                      IPV4_BITLENGTH_MAX : IPV6_BITLENGTH_MAX)) {
+        return 0;
+    }
+    hostmask = l3_utils_u128_hostmask(prefix_len);
+
+    while (n < count && !subnet_pool->exhausted) {
+        /* Align the cursor up to the next block boundary */
+        candidate.hi = subnet_pool->cursor.hi & ~hostmask.hi;
+        candidate.lo = subnet_pool->cursor.lo & ~hostmask.lo;
+        if (l3_utils_u128_cmp(&candidate, &subnet_pool->cursor) != 0) {
+            candidate = l3_utils_u128_block_last(&subnet_pool->cursor,
+                                                 prefix_len);
+            if (!l3_utils_u128_inc(&candidate)) {
+                subnet_pool->exhausted = true;
+                break;
+            }
+        }
+        last = l3_utils_u128_block_last(&candidate, prefix_len);
+        if (l3_utils_u128_cmp(&last, &subnet_pool->pool_last) > 0) {
+            subnet_pool->exhausted = true;
+            break;
+        }
+
+        /* Skip over any occupied range overlapping the candidate */
+        while (subnet_pool->next_occupied < subnet_pool->n_occupied &&
+               l3_utils_u128_cmp(
+                   &subnet_pool->occupied[subnet_pool->next_occupied].last,
+                   &candidate) < 0) {
+            subnet_pool->next_occupied++;
+        }
+        if (subnet_pool->next_occupied < subnet_pool->n_occupied) {
+            range = &subnet_pool->occupied[subnet_pool->next_occupied];
+            if (l3_utils_u128_cmp(&range->first, &last) <= 0) {
+                l3_utils_subnet_pool_advance(subnet_pool, &range->last);
+                continue;
+            }
+        }
+
+        l3_utils_u128_to_prefix(&candidate, subnet_pool->pool.family,
+                                prefix_len, &subnets[n++]);
+        l3_utils_subnet_pool_advance(subnet_pool, &last);
+    }
+    return n;
+}
+
+void
+l3_utils_subnet_pool_destroy (struct l3_utils_subnet_pool *subnet_pool)
+{
+    if (subnet_pool) {
+        free(subnet_pool->occupied);
+        free(subnet_pool);
+    }
+}
+
+/*
+ * Returns up to count free subnets of length prefix_len from pool that do
+ * not overlap any address configured in vrf_row.
+ */
+size_t
+l3_utils_find_free_subnets (const struct ovsrec_vrf *vrf_row,
+                            const struct l3_utils_prefix *pool,
+                            unsigned int prefix_len, size_t count,
+                            struct l3_utils_prefix *subnets)
+{
+    struct l3_utils_subnet_pool *subnet_pool;
+    size_t n;
+
+    subnet_pool = l3_utils_subnet_pool_create(vrf_row, pool);
+    if (subnet_pool == NULL) {
+        return 0;
+    }
+    n = l3_utils_subnet_pool_alloc(subnet_pool, prefix_len, count, subnets);
+    l3_utils_subnet_pool_destroy(subnet_pool);
+    return n;
+}
+
+/*********************************************************
+ *                 Address Bloom filter                  *
+ *********************************************************/
+
+/*
+ * Blocked Bloom filter over the configured prefixes of one or all VRFs.
+ * Each key sets L3_UTILS_FILTER_K bits inside a single 64 byte block, so
+ * a lookup touches one cache line per key probed.
+ *
+ * Every prefix p/len is inserted as an exact key (len, p). To also catch
+ * configured prefixes that are longer than the queried one, p is inserted
+ * as a cover key at each multiple of L3_UTILS_FILTER_STRIDE below len. A
+ * query for q/len then probes the exact key of q masked to each distinct
+ * configured length up to len, plus a single cover key of q masked to len
+ * rounded down to the stride.
+ */
+#define L3_UTILS_FILTER_BLOCK_WORDS    8     /* 512 bit blocks */
+#define L3_UTILS_FILTER_BLOCK_BITS     (L3_UTILS_FILTER_BLOCK_WORDS * 64)
+#define L3_UTILS_FILTER_K              4     /* Bits set per key */
+#define L3_UTILS_FILTER_BITS_PER_KEY   16
+#define L3_UTILS_FILTER_STRIDE         8
+#define L3_UTILS_FILTER_COVER_KEY      0x100
+
+/* Index into per-family arrays */
+#define L3_UTILS_FILTER_FAMILY(FAMILY) ((FAMILY) == AF_INET6)
+
+struct l3_utils_addr_filter {
+    uint64_t *blocks;                   /* n_blocks * BLOCK_WORDS words */
+    size_t block_mask;                  /* n_blocks - 1 */
+    /* Distinct configured prefix lengths per family, ascending */
+    u_char lens[2][IPV6_BITLENGTH_MAX + 1];
+    unsigned int n_lens[2];
+};
+
+/*
+ * Cached per-VRF filter, see l3_utils_addr_filter_get(). It is current as
+ * long as neither the VRF row nor any of its Port rows changed since it
+ * was built, which the change sequence numbers of the rows tell.
+ */
+struct l3_utils_addr_filter_node {
+    struct hmap_node hmap_node;         /* In l3_utils_filter_cache */
+    struct uuid vrf_uuid;
+    unsigned int stamp;                 /* Latest row change when built */
+    bool committed;                     /* No row had uncommitted changes */
+    struct l3_utils_addr_filter *filter;
+};
+
+static struct hmap l3_utils_filter_cache =
+    HMAP_INITIALIZER(&l3_utils_filter_cache);
+static struct l3_utils_addr_filter *l3_utils_filter_global;
+static const struct ovsdb_idl *l3_utils_filter_idl;
+static unsigned int l3_utils_filter_port_seqno;
+static unsigned int l3_utils_filter_vrf_seqno;
+
+static inline uint64_t
+l3_utils_filter_mix (uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static inline uint64_t
+l3_utils_filter_hash (const struct l3_utils_u128 *value, u_char family,
+                      unsigned int key)
+{
+    uint64_t basis = ((uint64_t) family << 32) | key;
+
+    return l3_utils_filter_mix(value->hi ^
+                               l3_utils_filter_mix(value->lo ^ basis));
+}
+
+/*
+ * Returns value with the host bits of a prefix of length prefix_len
+ * cleared.
+ */
+static inline struct l3_utils_u128
+l3_utils_u128_mask (const struct l3_utils_u128 *value, unsigned int prefix_len)
+{
+    struct l3_utils_u128 masked = l3_utils_u128_hostmask(prefix_len);
+
+    masked.hi = value->hi & ~masked.hi;
+    masked.lo = value->lo & ~masked.lo;
+    return masked;
+}
+
+static void
+l3_utils_filter_insert (struct l3_utils_addr_filter *filter,
+                        const struct l3_utils_u128 *value, u_char family,
+                        unsigned int key)
+{
+    uint64_t h = l3_utils_filter_hash(value, family, key);
+    uint64_t *block;
+    unsigned int bit;
+    int i;
+
+    block = &filter->blocks[((h >> 40) & filter->block_mask) *
+                            L3_UTILS_FILTER_BLOCK_WORDS];
+    for (i = 0; i < L3_UTILS_FILTER_K; i++, h >>= 9) {
+        bit = h % L3_UTILS_FILTER_BLOCK_BITS;
+        block[bit / 64] |= (uint64_t) 1 << (bit % 64);
+    }
+}
+
+static bool
+l3_utils_filter_lookup (const struct l3_utils_addr_filter *filter,
+                        const struct l3_utils_u128 *value, u_char family,
+                        unsigned int key)
+{
+    uint64_t h = l3_utils_filter_hash(value, family, key);
+    const uint64_t *block;
+    unsigned int bit;
+    int i;
+
+    block = &filter->blocks[((h >> 40) & filter->block_mask) *
+                            L3_UTILS_FILTER_BLOCK_WORDS];
+    for (i = 0; i < L3_UTILS_FILTER_K; i++, h >>= 9) {
+        bit = h % L3_UTILS_FILTER_BLOCK_BITS;
+        if (!(block[bit / 64] & ((uint64_t) 1 << (bit % 64)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Creates a filter holding an array of prefixes. Host bits of the
+ * prefixes are ignored.
+ */
+struct l3_utils_addr_filter *
+l3_utils_addr_filter_create (const struct l3_utils_prefix *prefixes, size_t n)
+{
+    struct l3_utils_addr_filter *filter;
+    bool seen[2][IPV6_BITLENGTH_MAX + 1];
+    struct l3_utils_u128 value, masked;
+    size_t i, n_keys = 0, n_blocks = 1;
+    unsigned int len, f;
+
+    for (i = 0; i < n; i++) {
+        n_keys += 1 + DIV_ROUND_UP(prefixes[i].prefix_len,
+                                   L3_UTILS_FILTER_STRIDE);
+    }
+    while (n_blocks * L3_UTILS_FILTER_BLOCK_BITS <
+           n_keys * L3_UTILS_FILTER_BITS_PER_KEY) {
+        n_blocks <<= 1;
+    }
+
+    filter = xzalloc(sizeof *filter);
+    filter->blocks = xcalloc(n_blocks * L3_UTILS_FILTER_BLOCK_WORDS,
+                             sizeof *filter->blocks);
+    filter->block_mask = n_blocks - 1;
+
+    memset(seen, 0, sizeof seen);
+    for (i = 0; i < n; i++) {
+        if (prefixes[i].family != AF_INET && prefixes[i].family != AF_INET6) {
+            continue;
+        }
+        f = L3_UTILS_FILTER_FAMILY(prefixes[i].family);
+        seen[f][prefixes[i].prefix_len] = true;
+
+        l3_utils_prefix_to_u128(&prefixes[i], &value);
+        masked = l3_utils_u128_mask(&value, prefixes[i].prefix_len);
+        l3_utils_filter_insert(filter, &masked, prefixes[i].family,
+                               prefixes[i].prefix_len);
+        for (len = 0; len < prefixes[i].prefix_len;
+             len += L3_UTILS_FILTER_STRIDE) {
+            masked = l3_utils_u128_mask(&value, len);
+            l3_utils_filter_insert(filter, &masked, prefixes[i].family,
+                                   len | L3_UTILS_FILTER_COVER_KEY);
+        }
+    }
+
+    for (f = 0; f < 2; f++) {
+        for (len = 0; len <= IPV6_BITLENGTH_MAX; len++) {
+            if (seen[f][len]) {
+                filter->lens[f][filter->n_lens[f]++] = len;
+            }
+        }
+    }
+    return filter;
+}
+
+void
+l3_utils_addr_filter_destroy (struct l3_utils_addr_filter *filter)
+{
+    if (filter) {
+        free(filter->blocks);
+        free(filter);
+    }
+}
+
+/*
+ * Checks if prefix may overlap a prefix held by the filter. A false
+ * result is exact; a true result must be confirmed by an exact check.
+ */
+bool
+l3_utils_addr_filter_may_overlap (const struct l3_utils_addr_filter *filter,
+                                  const struct l3_utils_prefix *prefix)
+{
+    struct l3_utils_u128 value, masked;
+    unsigned int f, i, len;
+
+    if (prefix->family != AF_INET && prefix->family != AF_INET6) {
+        return false;
+    }
+    f = L3_UTILS_FILTER_FAMILY(prefix->family);
+    l3_utils_prefix_to_u128(prefix, &value);
+
+    /* Configured prefixes as long as or shorter than the input */
+    for (i = 0; i < filter->n_lens[f]; i++) {
+        len = filter->lens[f][i];
+        if (len > prefix->prefix_len) {
+            break;
+        }
+        masked = l3_utils_u128_mask(&value, len);
+        if (l3_utils_filter_lookup(filter, &masked, prefix->family, len)) {
+            return true;
+        }
+    }
+
+    /* Configured prefixes longer than the input */
+    if (i < filter->n_lens[f]) {
+        len = prefix->prefix_len / L3_UTILS_FILTER_STRIDE *
+              L3_UTILS_FILTER_STRIDE;
+        masked = l3_utils_u128_mask(&value, len);
+        if (l3_utils_filter_lookup(filter, &masked, prefix->family,
+                                   len | L3_UTILS_FILTER_COVER_KEY)) {
+            return true;
+        }
+    }
     return false;
 }
+
+/* Drops every cached filter */
+static void
+l3_utils_filter_cache_flush (void)
+{
+    struct l3_utils_addr_filter_node *node;
+
+    HMAP_FOR_EACH_POP (node, hmap_node, &l3_utils_filter_cache) {
+        l3_utils_addr_filter_destroy(node->filter);
+        free(node);
+    }
+    l3_utils_addr_filter_destroy(l3_utils_filter_global);
+    l3_utils_filter_global = NULL;
+}
+
+/* Drops the filters of VRFs that no longer exist */
+static void
+l3_utils_filter_cache_prune (const struct ovsdb_idl *idl)
+{
+    struct l3_utils_addr_filter_node *node, *next;
+
+    HMAP_FOR_EACH_SAFE (node, next, hmap_node, &l3_utils_filter_cache) {
+        if (ovsrec_vrf_get_for_uuid(idl, &node->vrf_uuid) == NULL) {
+            hmap_remove(&l3_utils_filter_cache, &node->hmap_node);
+            l3_utils_addr_filter_destroy(node->filter);
+            free(node);
+        }
+    }
+}
+
+/*
+ * Sets *stamp to the sequence number of the latest change to vrf_row or to
+ * one of its ports. Returns false if one of them has changes in the
+ * caller's open transaction, which do not move sequence numbers.
+ */
+static bool
+l3_utils_vrf_change_stamp (const struct ovsrec_vrf *vrf_row,
+                           unsigned int *stamp)
+{
+    const struct ovsrec_port *port_row;
+    size_t i;
+
+    if (vrf_row->header_.old != vrf_row->header_.new) {
+        return false;
+    }
+    *stamp = MAX(ovsrec_vrf_row_get_seqno(vrf_row, OVSDB_IDL_CHANGE_INSERT),
+                 ovsrec_vrf_row_get_seqno(vrf_row, OVSDB_IDL_CHANGE_MODIFY));
+    for (i = 0; i < vrf_row->n_ports; i++) {
+        port_row = vrf_row->ports[i];
+        if (port_row->header_.old != port_row->header_.new) {
+            return false;
+        }
+        *stamp = MAX(*stamp,
+                     ovsrec_port_row_get_seqno(port_row,
+                                               OVSDB_IDL_CHANGE_INSERT));
+        *stamp = MAX(*stamp,
+                     ovsrec_port_row_get_seqno(port_row,
+                                               OVSDB_IDL_CHANGE_MODIFY));
+    }
+    return true;
+}
+
+/*
+ * Returns the filter of vrf_row, rebuilding it if the VRF or its ports
+ * changed since it was built. If they have uncommitted changes the filter
+ * is rebuilt from them on every call, or NULL is returned if
+ * build_uncommitted is false.
+ */
+static const struct l3_utils_addr_filter *
+l3_utils_vrf_filter (const struct ovsrec_vrf *vrf_row, bool build_uncommitted)
+{
+    struct l3_utils_addr_filter_node *node;
+    struct l3_utils_prefix *prefixes;
+    unsigned int stamp = 0;
+    bool committed;
+    uint32_t hash;
+    size_t n;
+
+    committed = l3_utils_vrf_change_stamp(vrf_row, &stamp);
+    if (!committed && !build_uncommitted) {
+        return NULL;
+    }
+
+    hash = uuid_hash(&vrf_row->header_.uuid);
+    HMAP_FOR_EACH_WITH_HASH (node, hmap_node, hash, &l3_utils_filter_cache) {
+        if (uuid_equals(&node->vrf_uuid, &vrf_row->header_.uuid)) {
+            break;
+        }
+    }
+    if (node == NULL) {
+        node = xzalloc(sizeof *node);
+        node->vrf_uuid = vrf_row->header_.uuid;
+        hmap_insert(&l3_utils_filter_cache, &node->hmap_node, hash);
+    }
+    else if (committed && node->committed && (node->stamp == stamp)) {
+        return node->filter;
+    }
+
+    n = l3_utils_vrf_get_prefixes(vrf_row, AF_UNSPEC, &prefixes);
+    l3_utils_addr_filter_destroy(node->filter);
+    node->filter = l3_utils_addr_filter_create(prefixes, n);
+    node->stamp = stamp;
+    node->committed = committed;
+    free(prefixes);
+
+    return node->filter;
+}
+
+/*
+ * Returns the cached filter for vrf_row, or for all VRFs if vrf_row is
+ * NULL. A VRF's filter is rebuilt when its row or one of its Port rows
+ * changed, the filter of all VRFs when the Port or VRF table changed.
+ */
+const struct l3_utils_addr_filter *
+l3_utils_addr_filter_get (const struct ovsdb_idl *idl,
+                          const struct ovsrec_vrf *vrf_row)
+{
+    const struct ovsrec_vrf *row;
+    struct l3_utils_prefix *prefixes, *vrf_prefixes;
+    unsigned int port_seqno = ovsrec_port_get_seqno(idl);
+    unsigned int vrf_seqno = ovsrec_vrf_get_seqno(idl);
+    size_t n, n_vrf;
+
+    if (l3_utils_filter_idl != idl) {
+        l3_utils_filter_cache_flush();
+        l3_utils_filter_idl = idl;
+    }
+    else if ((l3_utils_filter_port_seqno != port_seqno) ||
+             (l3_utils_filter_vrf_seqno != vrf_seqno)) {
+        l3_utils_addr_filter_destroy(l3_utils_filter_global);
+        l3_utils_filter_global = NULL;
+        if (l3_utils_filter_vrf_seqno != vrf_seqno) {
+            l3_utils_filter_cache_prune(idl);
+        }
+    }
+    l3_utils_filter_port_seqno = port_seqno;
+    l3_utils_filter_vrf_seqno = vrf_seqno;
+
+    if (vrf_row != NULL) {
+        return l3_utils_vrf_filter(vrf_row, true);
+    }
+
+    if (l3_utils_filter_global == NULL) {
+        prefixes = NULL;
+        n = 0;
+        OVSREC_VRF_FOR_EACH (row, idl) {
+            n_vrf = l3_utils_vrf_get_prefixes(row, AF_UNSPEC, &vrf_prefixes);
+            prefixes = xrealloc(prefixes, (n + n_vrf) * sizeof *prefixes);
+            memcpy(&prefixes[n], vrf_prefixes, n_vrf * sizeof *prefixes);
+            n += n_vrf;
+            free(vrf_prefixes);
+        }
+        l3_utils_filter_global = l3_utils_addr_filter_create(prefixes, n);
+        free(prefixes);
+    }
+    return l3_utils_filter_global;
+}
+
+/*
+ * Prefilter for l3_utils_is_ipaddr_overlapping(). Returns false if
+ * ip_address is definitely not overlapping any address configured in
+ * vrf_row (or in any VRF if vrf_row is NULL).
+ */
+bool
+l3_utils_ipaddr_may_overlap (const struct ovsdb_idl *idl,
+                             const char *ip_address, u_char addr_family,
+                             const struct ovsrec_vrf *vrf_row)
+{
+    struct l3_utils_prefix prefix;
+
+    if (!l3_utils_parse_prefix(ip_address, addr_family, &prefix)) {
+        return false;
+    }
+    return l3_utils_addr_filter_may_overlap(
+               l3_utils_addr_filter_get(idl, vrf_row), &prefix);
+}
@@ -0,0 +1,1017 @@
+/*
+ Copyright (C) 2016 Hewlett-Packard Development Company, L.P.
+ All Rights Reserved.
+
+    Licensed under the Apache License, Version 2.0 (the "License"); you may
+    not use this file except in compliance with the License. You may obtain
+    a copy of the License at
+
+         http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+    WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+    License for the specific language governing permissions and limitations
+    under the License.
+*/
+
+/*************************************************************************//**
+ * @ingroup mac_utils
+ * This module contains the DEFINES and functions that comprise the
+ * mac-utils library.
+ *
+ * @file
+ * Source file for mac-utils library.
+ *
+ ****************************************************************************/
+
+#include <string.h>
+#include <netinet/ether.h>
+
+#include "hmap.h"
+#include "util.h"
+#include "uuid.h"
+#include "vswitch-idl.h"
+#include "ops-utils.h"
+#include "mac-utils.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*****************************************************************************
+ *                          MAC by VLAN view                                 *
+ *****************************************************************************/
+
+/* A MAC row and its place in the view */
+struct mac_vlan_entry {
+    struct hmap_node node;             /* In mac_vlan_view.entries */
+    struct uuid uuid;                  /* MAC row uuid */
+    const struct ovsrec_mac *mac_row;
+    int vlan_id;                       /* Bucket holding the row */
+    size_t pos;                        /* Index of the row in its bucket */
+};
+
+/*
+ * MAC rows of one VLAN. rows[] is what callers iterate, entries[] holds
+ * the matching view entries so that a removal can swap the last row into
+ * the hole and fix up its position.
+ */
+struct mac_vlan_bucket {
+    const struct ovsrec_mac **rows;
+    struct mac_vlan_entry **entries;
+    size_t n;
+    size_t allocated;
+};
+
+static struct {
+    const struct ovsdb_idl *idl;
+    unsigned int seqno;
+    bool valid;
+    struct hmap entries;               /* Of struct mac_vlan_entry */
+    struct mac_vlan_bucket buckets[OPS_VLAN_ID_COUNT];
+} mac_vlan_view;
+
+/* Returns the bucket of a MAC row, 0 if it has no VLAN */
+static int
+mac_vlan_view_row_vlan(const struct ovsrec_mac *mac_row)
+{
+    int vlan_id = ops_mac_get_vlan(mac_row);
+
+    return (vlan_id > 0) && (vlan_id < OPS_VLAN_ID_COUNT) ? vlan_id : 0;
+}
+
+static struct mac_vlan_entry *
+mac_vlan_view_find(const struct ovsrec_mac *mac_row)
+{
+    struct mac_vlan_entry *entry;
+
+    HMAP_FOR_EACH_WITH_HASH (entry, node, uuid_hash(&mac_row->header_.uuid),
+                             &mac_vlan_view.entries) {
+        if (uuid_equals(&entry->uuid, &mac_row->header_.uuid)) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void
+mac_vlan_bucket_reserve(struct mac_vlan_bucket *bucket, size_t n)
+{
+    if (n > bucket->allocated) {
+        bucket->allocated = MAX(n, 2 * bucket->allocated);
+        bucket->rows = xrealloc(bucket->rows,
+                                bucket->allocated * sizeof *bucket->rows);
+        bucket->entries = xrealloc(bucket->entries,
+                                   bucket->allocated *
+                                   sizeof *bucket->entries);
+    }
+}
+
+static void
+mac_vlan_bucket_add(struct mac_vlan_entry *entry)
+{
+    struct mac_vlan_bucket *bucket = &mac_vlan_view.buckets[entry->vlan_id];
+
+    mac_vlan_bucket_reserve(bucket, bucket->n + 1);
+    entry->pos = bucket->n++;
+    bucket->rows[entry->pos] = entry->mac_row;
+    bucket->entries[entry->pos] = entry;
+}
+
+static void
+mac_vlan_bucket_remove(struct mac_vlan_entry *entry)
+{
+    struct mac_vlan_bucket *bucket = &mac_vlan_view.buckets[entry->vlan_id];
+    struct mac_vlan_entry *last = bucket->entries[--bucket->n];
+
+    bucket->rows[entry->pos] = last->mac_row;
+    bucket->entries[entry->pos] = last;
+    last->pos = entry->pos;
+}
+
+static void
+mac_vlan_view_clear(void)
+{
+    struct mac_vlan_entry *entry;
+    int vid;
+
+    if (!mac_vlan_view.valid) {
+        return;
+    }
+    HMAP_FOR_EACH_POP (entry, node, &mac_vlan_view.entries) {
+        free(entry);
+    }
+    hmap_destroy(&mac_vlan_view.entries);
+    for (vid = 0; vid < OPS_VLAN_ID_COUNT; vid++) {
+        free(mac_vlan_view.buckets[vid].rows);
+        free(mac_vlan_view.buckets[vid].entries);
+    }
+    memset(mac_vlan_view.buckets, 0, sizeof mac_vlan_view.buckets);
+    mac_vlan_view.valid = false;
+}
+
+/*
+ * Builds the view with a counting sort: one pass over the MAC table to
+ * create the entries and count the rows of each VLAN, then each bucket is
+ * allocated at its exact size and filled in a second pass.
+ */
+static void
+mac_vlan_view_build(struct ovsdb_idl *idl)
+{
+    const struct ovsrec_mac *mac_row = NULL;
+    struct mac_vlan_entry *entry;
+    struct mac_vlan_bucket *bucket;
+    int vid;
+
+    hmap_init(&mac_vlan_view.entries);
+    OVSREC_MAC_FOR_EACH (mac_row, idl) {
+        entry = xmalloc(sizeof *entry);
+        entry->uuid = mac_row->header_.uuid;
+        entry->mac_row = mac_row;
+        entry->vlan_id = mac_vlan_view_row_vlan(mac_row);
+        hmap_insert(&mac_vlan_view.entries, &entry->node,
+                    uuid_hash(&entry->uuid));
+        mac_vlan_view.buckets[entry->vlan_id].allocated++;
+    }
+
+    for (vid = 0; vid < OPS_VLAN_ID_COUNT; vid++) {
+        bucket = &mac_vlan_view.buckets[vid];
+        if (bucket->allocated) {
+            bucket->rows = xmalloc(bucket->allocated * sizeof *bucket->rows);
+            bucket->entries = xmalloc(bucket->allocated *
+                                      sizeof *bucket->entries);
+        }
+    }
+
+    HMAP_FOR_EACH (entry, node, &mac_vlan_view.entries) {
+        mac_vlan_bucket_add(entry);
+    }
+}
+
+/* Applies one tracked MAC row change to the view */
+static void
+mac_vlan_view_update(const struct ovsrec_mac *mac_row)
+{
+    struct mac_vlan_entry *entry = mac_vlan_view_find(mac_row);
+    int vlan_id;
+
+    if (ovsrec_mac_row_get_seqno(mac_row, OVSDB_IDL_CHANGE_DELETE) > 0) {
+        if (entry != NULL) {
+            mac_vlan_bucket_remove(entry);
+            hmap_remove(&mac_vlan_view.entries, &entry->node);
+            free(entry);
+        }
+        return;
+    }
+
+    vlan_id = mac_vlan_view_row_vlan(mac_row);
+    if (entry == NULL) {
+        entry = xmalloc(sizeof *entry);
+        entry->uuid = mac_row->header_.uuid;
+        entry->mac_row = mac_row;
+        entry->vlan_id = vlan_id;
+        hmap_insert(&mac_vlan_view.entries, &entry->node,
+                    uuid_hash(&entry->uuid));
+        mac_vlan_bucket_add(entry);
+    }
+    else if (entry->vlan_id != vlan_id) {
+        mac_vlan_bucket_remove(entry);
+        entry->vlan_id = vlan_id;
+        mac_vlan_bucket_add(entry);
+    }
+}
+
+void
+ops_mac_vlan_view_run(struct ovsdb_idl *idl)
+{
+    const struct ovsrec_mac *mac_row = NULL;
+    unsigned int seqno;
+    unsigned int tracked_seqno = 0;
+
+    if (idl == NULL) {
+        return;
+    }
+
+    seqno = ovsrec_mac_get_seqno(idl);
+    if (mac_vlan_view.valid && mac_vlan_view.idl == idl) {
+        if (mac_vlan_view.seqno == seqno) {
+            return;
+        }
+        OVSREC_MAC_FOR_EACH_TRACKED (mac_row, idl) {
+            mac_vlan_view_update(mac_row);
+            tracked_seqno = MAX(tracked_seqno,
+                ovsrec_mac_row_get_seqno(mac_row, OVSDB_IDL_CHANGE_INSERT));
+            tracked_seqno = MAX(tracked_seqno,
+                ovsrec_mac_row_get_seqno(mac_row, OVSDB_IDL_CHANGE_MODIFY));
+            tracked_seqno = MAX(tracked_seqno,
+                ovsrec_mac_row_get_seqno(mac_row, OVSDB_IDL_CHANGE_DELETE));
+        }
+        /* A learned MAC moving VLAN that tracking did not report would
+         * stay in its old bucket: re-sort the table instead. */
+        if (tracked_seqno >= seqno) {
+            mac_vlan_view.seqno = seqno;
+            return;
+        }
+    }
+
+    mac_vlan_view_clear();
+    mac_vlan_view_build(idl);
+    mac_vlan_view.idl = idl;
+    mac_vlan_view.seqno = seqno;
+    mac_vlan_view.valid = true;
+}
+
+void
+ops_mac_vlan_view_invalidate(void)
+{
+    mac_vlan_view_clear();
+}
+
+size_t
+ops_mac_vlan_get_count(int vlan_id, struct ovsdb_idl *idl)
+{
+    size_t n;
+
+    ops_mac_vlan_get_rows(vlan_id, idl, &n);
+    return n;
+}
+
+const struct ovsrec_mac *const *
+ops_mac_vlan_get_rows(int vlan_id, struct ovsdb_idl *idl, size_t *n)
+{
+    const struct mac_vlan_bucket *bucket;
+
+    *n = 0;
+    if ((idl == NULL) || (vlan_id < 0) || (vlan_id >= OPS_VLAN_ID_COUNT)) {
+        return NULL;
+    }
+
+    ops_mac_vlan_view_run(idl);
+    bucket = &mac_vlan_view.buckets[vlan_id];
+    if (bucket->n == 0) {
+        return NULL;
+    }
+    *n = bucket->n;
+    return bucket->rows;
+}
+
+/*****************************************************************************
+ *                          MAC+VLAN hash table                              *
+ *****************************************************************************/
+
+/*
+ * Slots are split in aligned groups of MAC_TABLE_GROUP. A key's hash picks
+ * its first group (high bits) and a 7-bit tag stored in the slot's control
+ * byte (low bits). Lookups compare the tag against a whole group at once
+ * and visit further groups, in triangular order, only while the current
+ * group has no empty slot. A removed key leaves a tombstone unless its
+ * group has an empty slot, since no probe then continues past the group.
+ */
+#define MAC_TABLE_GROUP     16
+#define MAC_TABLE_EMPTY     0x80
+#define MAC_TABLE_DELETED   0xfe
+#define MAC_TABLE_PREFETCH  16        /* Keys hashed ahead in lookups */
+
+static inline uint64_t
+mac_table_hash(uint64_t key)
+{
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return key;
+}
+
+static inline uint8_t
+mac_table_tag(uint64_t hash)
+{
+    return hash & 0x7f;
+}
+
+static inline size_t
+mac_table_first_group(const struct ops_mac_table *table, uint64_t hash)
+{
+    return (hash >> 7) & (table->capacity / MAC_TABLE_GROUP - 1);
+}
+
+/* Returns a bit per slot of the group whose control byte is byte */
+static inline uint32_t
+mac_table_group_match(const uint8_t *ctrl, uint8_t byte)
+{
+#if defined(__SSE2__)
+    __m128i group = _mm_loadu_si128((const __m128i *) ctrl);
+
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(byte)));
+#else
+    uint32_t mask = 0;
+    int i;
+
+    for (i = 0; i < MAC_TABLE_GROUP; i++) {
+        mask |= (uint32_t) (ctrl[i] == byte) << i;
+    }
+    return mask;
+#endif
+}
+
+/* Returns a bit per slot of the group that is empty or a tombstone */
+static inline uint32_t
+mac_table_group_match_free(const uint8_t *ctrl)
+{
+#if defined(__SSE2__)
+    return _mm_movemask_epi8(_mm_loadu_si128((const __m128i *) ctrl));
+#else
+    uint32_t mask = 0;
+    int i;
+
+    for (i = 0; i < MAC_TABLE_GROUP; i++) {
+        mask |= (uint32_t) (ctrl[i] >> 7) << i;
+    }
+    return mask;
+#endif
+}
+
+/* Returns the slot holding key, or SIZE_MAX */
+static size_t
+mac_table_find(const struct ops_mac_table *table, uint64_t key,
+               uint64_t hash)
+{
+    size_t group_mask, group, probe;
+    const uint8_t *ctrl;
+    uint32_t match;
+    size_t slot;
+
+    if (table->capacity == 0) {
+        return SIZE_MAX;
+    }
+
+    group_mask = table->capacity / MAC_TABLE_GROUP - 1;
+    group = mac_table_first_group(table, hash);
+    for (probe = 1; ; probe++) {
+        ctrl = &table->ctrl[group * MAC_TABLE_GROUP];
+        for (match = mac_table_group_match(ctrl, mac_table_tag(hash));
+             match; match &= match - 1) {
+            slot = group * MAC_TABLE_GROUP + __builtin_ctz(match);
+            if (table->slots[slot].key == key) {
+                return slot;
+            }
+        }
+        if (mac_table_group_match(ctrl, MAC_TABLE_EMPTY)) {
+            return SIZE_MAX;
+        }
+        group = (group + probe) & group_mask;
+    }
+}
+
+/* Stores a key known to be absent in a table with room for it */
+static void
+mac_table_store(struct ops_mac_table *table, uint64_t key, uint64_t hash,
+                void *data)
+{
+    size_t group_mask = table->capacity / MAC_TABLE_GROUP - 1;
+    size_t group = mac_table_first_group(table, hash);
+    uint32_t match;
+    size_t probe, slot;
+
+    for (probe = 1; ; probe++) {
+        match = mac_table_group_match_free(&table->ctrl[group *
+                                                        MAC_TABLE_GROUP]);
+        if (match) {
+            slot = group * MAC_TABLE_GROUP + __builtin_ctz(match);
+            break;
+        }
+        group = (group + probe) & group_mask;
+    }
+
+    if (table->ctrl[slot] == MAC_TABLE_DELETED) {
+        table->n_deleted--;
+    }
+    table->ctrl[slot] = mac_table_tag(hash);
+    table->slots[slot].key = key;
+    table->slots[slot].data = data;
+    table->n++;
+}
+
+/* Moves all keys to a table of the given capacity, dropping tombstones */
+static void
+mac_table_rehash(struct ops_mac_table *table, size_t capacity)
+{
+    struct ops_mac_table old = *table;
+    size_t slot;
+
+    table->ctrl = xmalloc(capacity);
+    memset(table->ctrl, MAC_TABLE_EMPTY, capacity);
+    table->slots = xmalloc(capacity * sizeof *table->slots);
+    table->capacity = capacity;
+    table->n = 0;
+    table->n_deleted = 0;
+
+    for (slot = 0; slot < old.capacity; slot++) {
+        if (!(old.ctrl[slot] & MAC_TABLE_EMPTY)) {
+            mac_table_store(table, old.slots[slot].key,
+                            mac_table_hash(old.slots[slot].key),
+                            old.slots[slot].data);
+        }
+    }
+    free(old.ctrl);
+    free(old.slots);
+}
+
+/* Keeps used slots, tombstones included, under 7/8 of the capacity */
+static size_t
+mac_table_capacity_for(size_t n)
+{
+    size_t capacity = MAC_TABLE_GROUP;
+
+    while (capacity / 8 * 7 < n) {
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+static void
+mac_table_make_room(struct ops_mac_table *table, size_t n_more)
+{
+    size_t used = table->n + table->n_deleted + n_more;
+
+    if (table->capacity && used <= table->capacity / 8 * 7) {
+        return;
+    }
+    /* Grow only if live keys need it, otherwise reclaim tombstones */
+    mac_table_rehash(table, mac_table_capacity_for(table->n + n_more));
+}
+
+void
+ops_mac_table_init(struct ops_mac_table *table)
+{
+    memset(table, 0, sizeof *table);
+}
+
+void
+ops_mac_table_destroy(struct ops_mac_table *table)
+{
+    free(table->ctrl);
+    free(table->slots);
+    ops_mac_table_init(table);
+}
+
+void
+ops_mac_table_reserve(struct ops_mac_table *table, size_t n)
+{
+    if (n > table->n) {
+        mac_table_make_room(table, n - table->n);
+    }
+}
+
+bool
+ops_mac_table_insert(struct ops_mac_table *table, uint64_t key, void *data)
+{
+    uint64_t hash = mac_table_hash(key);
+
+    if (mac_table_find(table, key, hash) != SIZE_MAX) {
+        return false;
+    }
+    mac_table_make_room(table, 1);
+    mac_table_store(table, key, hash, data);
+    return true;
+}
+
+bool
+ops_mac_table_lookup(const struct ops_mac_table *table, uint64_t key,
+                     void **data)
+{
+    size_t slot = mac_table_find(table, key, mac_table_hash(key));
+
+    if (slot == SIZE_MAX) {
+        return false;
+    }
+    if (data != NULL) {
+        *data = table->slots[slot].data;
+    }
+    return true;
+}
+
+bool
+ops_mac_table_remove(struct ops_mac_table *table, uint64_t key, void **data)
+{
+    size_t slot = mac_table_find(table, key, mac_table_hash(key));
+    const uint8_t *group;
+
+    if (slot == SIZE_MAX) {
+        return false;
+    }
+    if (data != NULL) {
+        *data = table->slots[slot].data;
+    }
+
+    group = &table->ctrl[slot & ~(size_t) (MAC_TABLE_GROUP - 1)];
+    if (mac_table_group_match(group, MAC_TABLE_EMPTY)) {
+        table->ctrl[slot] = MAC_TABLE_EMPTY;
+    }
+    else {
+        table->ctrl[slot] = MAC_TABLE_DELETED;
+        table->n_deleted++;
+    }
+    table->n--;
+    return true;
+}
+
+size_t
+ops_mac_table_insert_batch(struct ops_mac_table *table, const uint64_t *keys,
+                           void *const *data, size_t n, bool *inserted)
+{
+    size_t n_inserted = 0;
+    bool added;
+    size_t i;
+
+    ops_mac_table_reserve(table, table->n + n);
+    for (i = 0; i < n; i++) {
+        added = ops_mac_table_insert(table, keys[i],
+                                     data != NULL ? data[i] : NULL);
+        n_inserted += added;
+        if (inserted != NULL) {
+            inserted[i] = added;
+        }
+    }
+    return n_inserted;
+}
+
+size_t
+ops_mac_table_lookup_batch(const struct ops_mac_table *table,
+                           const uint64_t *keys, size_t n, void **data,
+                           bool *found)
+{
+    uint64_t hashes[MAC_TABLE_PREFETCH];
+    size_t n_found = 0;
+    size_t base, i, count, slot;
+
+    for (base = 0; base < n; base += MAC_TABLE_PREFETCH) {
+        count = MIN(n - base, MAC_TABLE_PREFETCH);
+        for (i = 0; i < count; i++) {
+            hashes[i] = mac_table_hash(keys[base + i]);
+            if (table->capacity) {
+                __builtin_prefetch(&table->ctrl[
+                    mac_table_first_group(table, hashes[i]) *
+                    MAC_TABLE_GROUP]);
+            }
+        }
+        for (i = 0; i < count; i++) {
+            slot = mac_table_find(table, keys[base + i], hashes[i]);
+            if (data != NULL) {
+                data[base + i] = slot != SIZE_MAX ? table->slots[slot].data
+                                                  : NULL;
+            }
+            if (found != NULL) {
+                found[base + i] = slot != SIZE_MAX;
+            }
+            n_found += slot != SIZE_MAX;
+        }
+    }
+    return n_found;
+}
+
+size_t
+ops_mac_table_remove_batch(struct ops_mac_table *table, const uint64_t *keys,
+                           size_t n)
+{
+    size_t n_removed = 0;
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        n_removed += ops_mac_table_remove(table, keys[i], NULL);
+    }
+    return n_removed;
+}
+
+size_t
+ops_mac_table_next(const struct ops_mac_table *table, size_t pos)
+{
+    for (; pos < table->capacity; pos++) {
+        if (!(table->ctrl[pos] & MAC_TABLE_EMPTY)) {
+            return pos;
+        }
+    }
+    return table->capacity;
+}
+
+/*****************************************************************************
+ *                          MAC range index                                  *
+ *****************************************************************************/
+
+#define MAC_INDEX_CHUNK_MAX  128      /* Entries per chunk */
+#define MAC_ADDR_MAX         0xffffffffffffULL
+
+struct mac_index_chunk {
+    size_t n;
+    struct ops_mac_index_entry entries[MAC_INDEX_CHUNK_MAX];
+};
+
+/* Returns the first chunk whose last MAC is not below mac, or n_chunks */
+static size_t
+mac_index_find_chunk(const struct ops_mac_index *index, uint64_t mac)
+{
+    const struct mac_index_chunk *chunk;
+    size_t low = 0, high = index->n_chunks, mid;
+
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        chunk = index->chunks[mid];
+        if (chunk->entries[chunk->n - 1].mac < mac) {
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+/* Returns the first entry of a chunk whose MAC is not below mac */
+static size_t
+mac_index_find_pos(const struct mac_index_chunk *chunk, uint64_t mac)
+{
+    size_t low = 0, high = chunk->n, mid;
+
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        if (chunk->entries[mid].mac < mac) {
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+static void
+mac_index_insert_chunk(struct ops_mac_index *index, size_t at,
+                       struct mac_index_chunk *chunk)
+{
+    if (index->n_chunks == index->allocated_chunks) {
+        index->chunks = x2nrealloc(index->chunks, &index->allocated_chunks,
+                                   sizeof *index->chunks);
+    }
+    memmove(&index->chunks[at + 1], &index->chunks[at],
+            (index->n_chunks - at) * sizeof *index->chunks);
+    index->chunks[at] = chunk;
+    index->n_chunks++;
+}
+
+void
+ops_mac_index_init(struct ops_mac_index *index)
+{
+    memset(index, 0, sizeof *index);
+}
+
+void
+ops_mac_index_destroy(struct ops_mac_index *index)
+{
+    size_t i;
+
+    for (i = 0; i < index->n_chunks; i++) {
+        free(index->chunks[i]);
+    }
+    free(index->chunks);
+    ops_mac_index_init(index);
+}
+
+void
+ops_mac_index_insert(struct ops_mac_index *index, uint64_t mac, void *data)
+{
+    struct mac_index_chunk *chunk, *next;
+    size_t at, pos, half;
+
+    if (index->n_chunks == 0) {
+        mac_index_insert_chunk(index, 0, xzalloc(sizeof *chunk));
+    }
+
+    /* Past the last MAC of every chunk, append to the last one */
+    at = MIN(mac_index_find_chunk(index, mac), index->n_chunks - 1);
+    chunk = index->chunks[at];
+
+    /* Split a full chunk in two halves and pick the one for mac */
+    if (chunk->n == MAC_INDEX_CHUNK_MAX) {
+        half = MAC_INDEX_CHUNK_MAX / 2;
+        next = xmalloc(sizeof *next);
+        next->n = MAC_INDEX_CHUNK_MAX - half;
+        memcpy(next->entries, &chunk->entries[half],
+               next->n * sizeof *next->entries);
+        chunk->n = half;
+        mac_index_insert_chunk(index, at + 1, next);
+        if (mac > chunk->entries[half - 1].mac) {
+            chunk = next;
+        }
+    }
+
+    pos = mac_index_find_pos(chunk, mac);
+    memmove(&chunk->entries[pos + 1], &chunk->entries[pos],
+            (chunk->n - pos) * sizeof *chunk->entries);
+    chunk->entries[pos].mac = mac;
+    chunk->entries[pos].data = data;
+    chunk->n++;
+    index->n++;
+}
+
+void
+ops_mac_index_insert_addr(struct ops_mac_index *index,
+                          const struct ether_addr *addr, void *data)
+{
+    ops_mac_index_insert(index,
+                         ops_char_array_to_ulong_long(
+                             (unsigned char *) addr->ether_addr_octet,
+                             ETH_ALEN),
+                         data);
+}
+
+bool
+ops_mac_index_remove(struct ops_mac_index *index, uint64_t mac, void *data)
+{
+    struct mac_index_chunk *chunk;
+    size_t at, pos;
+
+    /* Entries with the same MAC may span several chunks */
+    for (at = mac_index_find_chunk(index, mac); at < index->n_chunks; at++) {
+        chunk = index->chunks[at];
+        for (pos = mac_index_find_pos(chunk, mac);
+             pos < chunk->n && chunk->entries[pos].mac == mac; pos++) {
+            if (chunk->entries[pos].data != data) {
+                continue;
+            }
+            memmove(&chunk->entries[pos], &chunk->entries[pos + 1],
+                    (chunk->n - pos - 1) * sizeof *chunk->entries);
+            index->n--;
+            if (--chunk->n == 0) {
+                free(chunk);
+                memmove(&index->chunks[at], &index->chunks[at + 1],
+                        (index->n_chunks - at - 1) * sizeof *index->chunks);
+                index->n_chunks--;
+            }
+            return true;
+        }
+        if (pos < chunk->n) {
+            break;
+        }
+    }
+    return false;
+}
+
+void
+ops_mac_index_cursor_init(struct ops_mac_index_cursor *cursor,
+                          const struct ops_mac_index *index,
+                          uint64_t first, uint64_t last)
+{
+    cursor->index = index;
+    cursor->last = last;
+    cursor->chunk = mac_index_find_chunk(index, first);
+    cursor->pos = (cursor->chunk < index->n_chunks)
+                  ? mac_index_find_pos(index->chunks[cursor->chunk], first)
+                  : 0;
+}
+
+void
+ops_mac_index_cursor_init_prefix(struct ops_mac_index_cursor *cursor,
+                                 const struct ops_mac_index *index,
+                                 uint64_t prefix, unsigned int prefix_len)
+{
+    uint64_t host_mask;
+
+    prefix_len = MIN(prefix_len, 48);
+    host_mask = MAC_ADDR_MAX >> prefix_len;
+    prefix &= MAC_ADDR_MAX;
+    ops_mac_index_cursor_init(cursor, index, prefix & ~host_mask,
+                              prefix | host_mask);
+}
+
+const struct ops_mac_index_entry *
+ops_mac_index_cursor_next(struct ops_mac_index_cursor *cursor)
+{
+    const struct ops_mac_index *index = cursor->index;
+    const struct ops_mac_index_entry *entry;
+
+    if (cursor->chunk < index->n_chunks &&
+        cursor->pos == index->chunks[cursor->chunk]->n) {
+        cursor->chunk++;
+        cursor->pos = 0;
+    }
+    if (cursor->chunk >= index->n_chunks) {
+        return NULL;
+    }
+
+    entry = &index->chunks[cursor->chunk]->entries[cursor->pos];
+    if (entry->mac > cursor->last) {
+        cursor->chunk = index->n_chunks;
+        return NULL;
+    }
+    cursor->pos++;
+    return entry;
+}
+
+/*****************************************************************************
+ *                          MAC pool allocator                               *
+ *****************************************************************************/
+
+#define MAC_POOL_BIT(OFFSET)   ((uint64_t) 1 << ((OFFSET) % 64))
+
+static inline bool
+mac_pool_is_used(const struct ops_mac_pool *pool, size_t offset)
+{
+    return (pool->used[offset / 64] & MAC_POOL_BIT(offset)) != 0;
+}
+
+/* Returns the first offset at or after start whose bit equals used, or
+ * pool->size. Bits past the end of the range are always set. */
+static size_t
+mac_pool_scan(const struct ops_mac_pool *pool, size_t start, bool used)
+{
+    size_t i = start / 64;
+    uint64_t word;
+
+    if (start >= pool->size) {
+        return pool->size;
+    }
+    word = used ? pool->used[i] : ~pool->used[i];
+    word &= UINT64_MAX << (start % 64);
+    while (!word) {
+        if (++i >= pool->n_words) {
+            return pool->size;
+        }
+        word = used ? pool->used[i] : ~pool->used[i];
+    }
+    return MIN(i * 64 + __builtin_ctzll(word), pool->size);
+}
+
+static void
+mac_pool_set_range(struct ops_mac_pool *pool, size_t offset, size_t n,
+                   bool used)
+{
+    size_t i;
+
+    for (i = offset; i < offset + n; i++) {
+        if (used) {
+            pool->used[i / 64] |= MAC_POOL_BIT(i);
+        }
+        else {
+            pool->used[i / 64] &= ~MAC_POOL_BIT(i);
+        }
+    }
+    if (used) {
+        pool->n_used += n;
+    }
+    else {
+        pool->n_used -= n;
+        pool->hint = MIN(pool->hint, offset / 64);
+    }
+}
+
+bool
+ops_mac_pool_init(struct ops_mac_pool *pool, uint64_t base, size_t size)
+{
+    memset(pool, 0, sizeof *pool);
+    if ((size == 0) || (base > MAC_ADDR_MAX) ||
+        (size - 1 > MAC_ADDR_MAX - base)) {
+        return false;
+    }
+
+    pool->base = base;
+    pool->size = size;
+    pool->n_words = DIV_ROUND_UP(size, 64);
+    pool->used = xcalloc(pool->n_words, sizeof *pool->used);
+    if (size % 64) {
+        pool->used[pool->n_words - 1] = UINT64_MAX << (size % 64);
+    }
+    return true;
+}
+
+void
+ops_mac_pool_destroy(struct ops_mac_pool *pool)
+{
+    free(pool->used);
+    memset(pool, 0, sizeof *pool);
+}
+
+bool
+ops_mac_pool_alloc(struct ops_mac_pool *pool, uint64_t *mac)
+{
+    return ops_mac_pool_alloc_range(pool, 1, mac);
+}
+
+bool
+ops_mac_pool_alloc_range(struct ops_mac_pool *pool, size_t n,
+                         uint64_t *first)
+{
+    size_t start, end;
+
+    if ((n == 0) || (n > ops_mac_pool_count_free(pool))) {
+        return false;
+    }
+
+    start = mac_pool_scan(pool, pool->hint * 64, false);
+    pool->hint = MIN(start, pool->size) / 64;
+    while (start < pool->size) {
+        end = mac_pool_scan(pool, start, true);
+        if (end - start >= n) {
+            mac_pool_set_range(pool, start, n, true);
+            *first = pool->base + start;
+            return true;
+        }
+        start = mac_pool_scan(pool, end, false);
+    }
+    return false;
+}
+
+bool
+ops_mac_pool_mark_used(struct ops_mac_pool *pool, uint64_t mac)
+{
+    size_t offset;
+
+    if ((mac < pool->base) || (mac - pool->base >= pool->size)) {
+        return false;
+    }
+    offset = mac - pool->base;
+    if (mac_pool_is_used(pool, offset)) {
+        return false;
+    }
+    mac_pool_set_range(pool, offset, 1, true);
+    return true;
+}
+
+bool
+ops_mac_pool_free_range(struct ops_mac_pool *pool, uint64_t first, size_t n)
+{
+    size_t offset;
+
+    if ((first < pool->base) || (first - pool->base >= pool->size) ||
+        (n > pool->size - (first - pool->base))) {
+        return false;
+    }
+    offset = first - pool->base;
+    if (mac_pool_scan(pool, offset, false) < offset + n) {
+        return false;
+    }
+    mac_pool_set_range(pool, offset, n, false);
+    return true;
+}
+
+bool
+ops_mac_pool_free(struct ops_mac_pool *pool, uint64_t mac)
+{
+    return ops_mac_pool_free_range(pool, mac, 1);
+}
+
+size_t
+ops_mac_pool_restore(struct ops_mac_pool *pool, const char *const *mac_strs,
+                     size_t n)
+{
+    unsigned long long mac;
+    size_t i, n_marked = 0;
+
+    for (i = 0; i < n; i++) {
+        if ((mac_strs[i] != NULL) &&
+            ops_ether_string_to_ulong_long(mac_strs[i], &mac)) {
+            n_marked += ops_mac_pool_mark_used(pool, mac);
+        }
+    }
+    return n_marked;
+}
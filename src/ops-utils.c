@@ -30,8 +30,19 @@
 #include <sched.h>
 #include <string.h>
 #include <errno.h>
+#include <endian.h>
 
 #include "ops-utils.h"
+#include "hmap.h"
+#include "util.h"
+#include "uuid.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 /*********************************************************
  *                      PID Utility                      *
@@ -103,6 +114,13 @@ ops_char_array_to_ulong_long(unsigned char *char_array, unsigned int length)
 	unsigned long long   value = (unsigned long long)0;
 	unsigned int    i;
 
+	if (length == ETH_ALEN) {
+		return ops_mac_to_ulong_long(char_array);
+	}
+	if (length == 8) {
+		return ops_wwn_to_ulong_long(char_array);
+	}
+
 	for ( i = 0; i < length; i++ ) {
 		value = ( value << 8 ) + char_array[i];
 	}
@@ -123,12 +141,162 @@ ops_ulong_long_to_char_array(unsigned long long value, unsigned int length,
 	unsigned long long   temp = value;
 	int     i;
 
+	if (length == ETH_ALEN) {
+		ops_ulong_long_to_mac(value, char_array);
+		return;
+	}
+	if (length == 8) {
+		ops_ulong_long_to_wwn(value, char_array);
+		return;
+	}
+
 	for ( i = length - 1; i >= 0; i-- ) {
 		char_array[i] = temp & 0xff;
 		temp >>= 8;
 	}
 } /* ops_ulong_long_to_char_array */
 
+/*
+ * ops_mac_array_to_ulong_long
+ *
+ * Converts n packed 6 byte MAC addresses into 48-bit values. Every address
+ * but the last is read with an 8 byte load, the 2 extra bytes are shifted
+ * out.
+ */
+void
+ops_mac_array_to_ulong_long(const unsigned char *addrs, size_t n,
+		uint64_t *macs)
+{
+	uint64_t value;
+	size_t i;
+
+	if (n == 0) {
+		return;
+	}
+	for ( i = 0; i < n - 1; i++ ) {
+		memcpy(&value, addrs + i * ETH_ALEN, sizeof value);
+		macs[i] = be64toh(value) >> 16;
+	}
+	macs[n - 1] = ops_mac_to_ulong_long(addrs + (n - 1) * ETH_ALEN);
+} /* ops_mac_array_to_ulong_long */
+
+/*
+ * ops_ulong_long_to_mac_array
+ *
+ * Converts n 48-bit values into packed 6 byte MAC addresses. Every address
+ * but the last is written with an 8 byte store whose 2 extra bytes are
+ * overwritten by the next address.
+ */
+void
+ops_ulong_long_to_mac_array(const uint64_t *macs, size_t n,
+		unsigned char *addrs)
+{
+	uint64_t value;
+	size_t i;
+
+	if (n == 0) {
+		return;
+	}
+	for ( i = 0; i < n - 1; i++ ) {
+		value = htobe64(macs[i] << 16);
+		memcpy(addrs + i * ETH_ALEN, &value, sizeof value);
+	}
+	ops_ulong_long_to_mac(macs[n - 1], addrs + (n - 1) * ETH_ALEN);
+} /* ops_ulong_long_to_mac_array */
+
+/*
+ * Hex formatting of MAC and WWN addresses
+ *
+ * Addresses are formatted as lowercase "xx:xx:...", the same as
+ * snprintf("%02x:...") with unsigned bytes, through a nibble to digit
+ * table. On x86-64 CPUs with SSSE3 the digits of all bytes are looked up
+ * at once with pshufb and the colons merged in with a second shuffle.
+ */
+static const char ops_hex_digits[16] = "0123456789abcdef";
+
+typedef void ops_hex_format_func(char *str, const unsigned char *bytes,
+		unsigned int length);
+
+/* Writes length bytes as "xx:xx:...", 3 * length bytes with the NUL */
+static void
+ops_hex_format_generic(char *str, const unsigned char *bytes,
+		unsigned int length)
+{
+	unsigned int i;
+
+	for ( i = 0; i < length; i++ ) {
+		*str++ = ops_hex_digits[bytes[i] >> 4];
+		*str++ = ops_hex_digits[bytes[i] & 0x0f];
+		*str++ = ':';
+	}
+	str[-1] = '\0';
+}
+
+#if defined(__x86_64__) && defined(__GNUC__)
+/* Handles the 6 and 8 byte addresses, others go to the generic version */
+__attribute__((target("ssse3")))
+static void
+ops_hex_format_ssse3(char *str, const unsigned char *bytes,
+		unsigned int length)
+{
+	/* Output character k takes digit 2 * (k / 3) + k % 3, or is a colon */
+	const __m128i head = _mm_setr_epi8(0, 1, -1, 2, 3, -1, 4, 5,
+					   -1, 6, 7, -1, 8, 9, -1, 10);
+	const __m128i head_colons = _mm_setr_epi8(0, 0, ':', 0, 0, ':', 0, 0,
+						  ':', 0, 0, ':', 0, 0, ':', 0);
+	const __m128i tail = _mm_setr_epi8(11, -1, 12, 13, -1, 14, 15, -1,
+					   -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m128i tail_colons = _mm_setr_epi8(0, ':', 0, 0, ':', 0, 0, 0,
+						  0, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i low_nibble = _mm_set1_epi8(0x0f);
+	__m128i in, digits;
+	uint64_t word = 0;
+
+	if ((length != ETH_ALEN) && (length != 8)) {
+		ops_hex_format_generic(str, bytes, length);
+		return;
+	}
+
+	memcpy(&word, bytes, length);
+	in = _mm_cvtsi64_si128(word);
+	digits = _mm_unpacklo_epi8(
+			_mm_and_si128(_mm_srli_epi16(in, 4), low_nibble),
+			_mm_and_si128(in, low_nibble));
+	digits = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)
+						  ops_hex_digits), digits);
+
+	_mm_storeu_si128((__m128i *) str,
+			 _mm_or_si128(_mm_shuffle_epi8(digits, head),
+				      head_colons));
+	if (length == ETH_ALEN) {
+		str[16] = ops_hex_digits[bytes[5] & 0x0f];
+		str[17] = '\0';
+	}
+	else {
+		_mm_storel_epi64((__m128i *) (str + 16),
+				 _mm_or_si128(_mm_shuffle_epi8(digits, tail),
+					      tail_colons));
+	}
+}
+#endif
+
+static ops_hex_format_func *ops_hex_format_impl;
+
+static void
+ops_hex_format(char *str, const unsigned char *bytes, unsigned int length)
+{
+	if (ops_hex_format_impl == NULL) {
+		ops_hex_format_impl = ops_hex_format_generic;
+#if defined(__x86_64__) && defined(__GNUC__)
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("ssse3")) {
+			ops_hex_format_impl = ops_hex_format_ssse3;
+		}
+#endif
+	}
+	ops_hex_format_impl(str, bytes, length);
+}
+
 /*
  * ops_ether_ntoa - the pretty version of ether_ntoa
  *
@@ -139,10 +307,7 @@ ops_ulong_long_to_char_array(unsigned long long value, unsigned int length,
 char *
 ops_ether_ntoa(char *mac_a, const struct ether_addr *addr)
 {
-	(void)snprintf(mac_a, OPS_MAC_STR_SIZE, "%02x:%02x:%02x:%02x:%02x:%02x",
-			addr->ether_addr_octet[0], addr->ether_addr_octet[1],
-			addr->ether_addr_octet[2], addr->ether_addr_octet[3],
-			addr->ether_addr_octet[4], addr->ether_addr_octet[5]);
+	ops_hex_format(mac_a, addr->ether_addr_octet, ETH_ALEN);
 	return mac_a;
 } /* ops_ether_ntoa */
 
@@ -155,8 +320,8 @@ ops_ether_ntoa(char *mac_a, const struct ether_addr *addr)
 char *
 ops_wwn_ntoa(char *wwn_a, const char *wwn)
 {
-	(void)snprintf(wwn_a, OPS_WWN_STR_SIZE, "%02x:%02x:%02x:%02x:%02x:%02x:%02x:%02x",
-			wwn[0], wwn[1], wwn[2], wwn[3], wwn[4], wwn[5], wwn[6], wwn[7]);
+	/* Bytes are unsigned, a signed char would print as ffffffxx */
+	ops_hex_format(wwn_a, (const unsigned char *) wwn, 8);
 	return wwn_a;
 } /* ops_wwn_ntoa */
 
@@ -170,8 +335,7 @@ ops_wwn_ntoa(char *wwn_a, const char *wwn)
 char *
 ops_ether_array_to_string(char *mac_a, const unsigned char *addr)
 {
-	(void)snprintf(mac_a, OPS_MAC_STR_SIZE, "%02x:%02x:%02x:%02x:%02x:%02x",
-			addr[0], addr[1], addr[2], addr[3], addr[4], addr[5]);
+	ops_hex_format(mac_a, addr, ETH_ALEN);
 	return mac_a;
 } /* ops_ether_array_to_string */
 
@@ -192,14 +356,246 @@ ops_ether_ulong_long_to_string(char *mac_a, const unsigned long long mac)
 		return ( (char *) NULL);
 	}
 	ops_ulong_long_to_char_array(mac, ETH_ALEN, addr);
-
-	(void)snprintf(mac_a, OPS_MAC_STR_SIZE,
-		       "%02x:%02x:%02x:%02x:%02x:%02x",
-		       addr[0], addr[1], addr[2], addr[3], addr[4], addr[5]);
+	ops_hex_format(mac_a, addr, ETH_ALEN);
 
 	return mac_a;
 } /* ops_ether_ulong_long_to_string */
 
+/*
+ * ops_ether_ntoa_batch
+ *
+ * formats n Ethernet addresses into buf, one OPS_MAC_STR_SIZE string
+ * per address. returns buf.
+ */
+char *
+ops_ether_ntoa_batch(char *buf, const struct ether_addr *addrs, size_t n)
+{
+	size_t i;
+
+	for ( i = 0; i < n; i++ ) {
+		ops_hex_format(buf + i * OPS_MAC_STR_SIZE,
+			       addrs[i].ether_addr_octet, ETH_ALEN);
+	}
+	return buf;
+} /* ops_ether_ntoa_batch */
+
+/*
+ * ops_ether_ulong_long_to_string_batch
+ *
+ * formats n Ethernet addresses stored as long longs into buf, one
+ * OPS_MAC_STR_SIZE string per address. Values above 48 bits give an
+ * empty string. returns the number of addresses formatted.
+ */
+size_t
+ops_ether_ulong_long_to_string_batch(char *buf,
+		const unsigned long long *macs, size_t n)
+{
+	unsigned char addr[8];
+	uint64_t be;
+	size_t i, n_ok = 0;
+
+	for ( i = 0; i < n; i++ ) {
+		if (macs[i] > 0xffffffffffffULL) {
+			buf[i * OPS_MAC_STR_SIZE] = '\0';
+			continue;
+		}
+		/* Big endian 64-bit value, the MAC is its last 6 bytes */
+		be = htobe64(macs[i]);
+		memcpy(addr, &be, sizeof addr);
+		ops_hex_format(buf + i * OPS_MAC_STR_SIZE, addr + 2, ETH_ALEN);
+		n_ok++;
+	}
+	return n_ok;
+} /* ops_ether_ulong_long_to_string_batch */
+
+/*
+ * Parsing of MAC and WWN addresses
+ *
+ * Accepted forms are "aa:bb:cc:dd:ee:ff", "aa-bb-cc-dd-ee-ff" and
+ * "aabb.ccdd.eeff", in either case, and their 8 byte equivalents for WWNs.
+ * Every group must have all its digits and nothing may follow the last one.
+ */
+
+/* Returns the value of a hex digit, or -1 */
+static inline int
+ops_hex_value(unsigned char c)
+{
+	if ((unsigned char) (c - '0') < 10) {
+		return c - '0';
+	}
+	c |= 0x20;
+	if ((unsigned char) (c - 'a') < 6) {
+		return c - 'a' + 10;
+	}
+	return -1;
+}
+
+/* Parses length bytes in one of the accepted forms into *value */
+static bool
+ops_hex_parse(const char *str, unsigned int length,
+		unsigned long long *value)
+{
+	unsigned long long result = 0;
+	unsigned int digits, group, i;
+	char sep;
+	int hi, lo;
+
+	if ((str[0] == '\0') || (str[1] == '\0') || (str[2] == '\0')) {
+		return false;
+	}
+	sep = str[2];
+	if ((sep == ':') || (sep == '-')) {
+		digits = 2;
+	}
+	else if ((str[3] != '\0') && (str[4] == '.')) {
+		sep = '.';
+		digits = 4;
+	}
+	else {
+		return false;
+	}
+
+	for ( group = 0; group < length * 2 / digits; group++ ) {
+		if ((group > 0) && (*str++ != sep)) {
+			return false;
+		}
+		for ( i = 0; i < digits; i += 2 ) {
+			hi = ops_hex_value(str[0]);
+			if (hi < 0) {
+				return false;
+			}
+			lo = ops_hex_value(str[1]);
+			if (lo < 0) {
+				return false;
+			}
+			result = (result << 8) | (hi << 4) | lo;
+			str += 2;
+		}
+	}
+	if (*str != '\0') {
+		return false;
+	}
+
+	*value = result;
+	return true;
+}
+
+/*
+ * ops_ether_string_to_ulong_long
+ *
+ * parses a MAC address string into a 48-bit value. returns true on
+ * success, else false and mac is unchanged.
+ */
+bool
+ops_ether_string_to_ulong_long(const char *mac_a, unsigned long long *mac)
+{
+	return ops_hex_parse(mac_a, ETH_ALEN, mac);
+} /* ops_ether_string_to_ulong_long */
+
+/*
+ * ops_wwn_string_to_ulong_long
+ *
+ * World Wide Name version of ops_ether_string_to_ulong_long
+ */
+bool
+ops_wwn_string_to_ulong_long(const char *wwn_a, unsigned long long *wwn)
+{
+	return ops_hex_parse(wwn_a, 8, wwn);
+} /* ops_wwn_string_to_ulong_long */
+
+#if defined(__SSE2__)
+/*
+ * Parses "xx:xx:xx:xx:xx:xx" or the '-' form with the first 16 characters
+ * validated and decoded in one vector. Returns false if str is not in that
+ * form, in which case the caller falls back to ops_hex_parse. The 16 byte
+ * load is only done once the string is known to hold at least 17
+ * characters.
+ */
+static bool
+ops_ether_parse_sse2(const char *str, unsigned long long *mac)
+{
+	/* Separator positions within the first 16 characters */
+	const int sep_mask = 0x4924;
+	__m128i in, lower, is_digit, is_alpha, values;
+	unsigned char nibbles[16];
+	unsigned long long result = 0;
+	int digit_mask, last, i;
+
+	if ((str[0] == '\0') || (str[1] == '\0') || (str[2] == '\0')) {
+		return false;
+	}
+	if ((str[2] != ':') && (str[2] != '-')) {
+		return false;
+	}
+	if (strnlen(str, 17) != 17) {
+		return false;
+	}
+
+	in = _mm_loadu_si128((const __m128i *) str);
+	lower = _mm_or_si128(in, _mm_set1_epi8(0x20));
+	is_digit = _mm_and_si128(_mm_cmpgt_epi8(in, _mm_set1_epi8('0' - 1)),
+				 _mm_cmplt_epi8(in, _mm_set1_epi8('9' + 1)));
+	is_alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+				 _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+	digit_mask = _mm_movemask_epi8(_mm_or_si128(is_digit, is_alpha));
+	if ((digit_mask != (~sep_mask & 0xffff)) ||
+	    (_mm_movemask_epi8(_mm_cmpeq_epi8(in, _mm_set1_epi8(str[2])))
+	     != sep_mask)) {
+		return false;
+	}
+
+	/* str holds at least 17 characters, so str[17] exists */
+	last = ops_hex_value(str[16]);
+	if ((last < 0) || (str[17] != '\0')) {
+		return false;
+	}
+
+	values = _mm_or_si128(
+		_mm_and_si128(is_digit,
+			      _mm_sub_epi8(in, _mm_set1_epi8('0'))),
+		_mm_andnot_si128(is_digit,
+				 _mm_sub_epi8(lower,
+					      _mm_set1_epi8('a' - 10))));
+	_mm_storeu_si128((__m128i *) nibbles, values);
+
+	for ( i = 0; i < 15; i += 3 ) {
+		result = (result << 8) | (nibbles[i] << 4) | nibbles[i + 1];
+	}
+	*mac = (result << 8) | (nibbles[15] << 4) | last;
+	return true;
+}
+#endif
+
+/*
+ * ops_ether_string_to_ulong_long_batch
+ *
+ * parses n MAC address strings. ok[i], if ok is not NULL, tells whether
+ * strs[i] was valid, macs[i] is 0 if it was not. returns the number of
+ * valid strings.
+ */
+size_t
+ops_ether_string_to_ulong_long_batch(const char *const *strs, size_t n,
+		unsigned long long *macs, bool *ok)
+{
+	size_t i, n_ok = 0;
+	bool valid;
+
+	for ( i = 0; i < n; i++ ) {
+		macs[i] = 0;
+#if defined(__SSE2__)
+		valid = ops_ether_parse_sse2(strs[i], &macs[i]) ||
+			ops_hex_parse(strs[i], ETH_ALEN, &macs[i]);
+#else
+		valid = ops_hex_parse(strs[i], ETH_ALEN, &macs[i]);
+#endif
+		n_ok += valid;
+		if (ok != NULL) {
+			ok[i] = valid;
+		}
+	}
+	return n_ok;
+} /* ops_ether_string_to_ulong_long_batch */
+
 /*
  * Sorting function for generic elemnts
  * on success, returns sorted elemnts list.
@@ -230,6 +626,10 @@ ops_sort(const struct shash *sh, void *ptr_func_sort,
     return ret_val;
 }
 
+static void ops_port_update_trunks(const struct ovsrec_port *port_row,
+                                   const struct ops_vlan_bitmap *trunks,
+                                   struct ovsdb_idl *idl);
+
 /******************************************************************************
  * Setter function for tag column of port table
  *
@@ -258,7 +658,8 @@ bool ops_port_set_tag(int vlan_id,
             ret_val = true;
         }
 
-        if(ret_val) {
+        /* Skip no-op writes, they would still be sent to OVSDB */
+        if(ret_val && (port_row->vlan_tag != vlan_row)) {
             ovsrec_port_set_vlan_tag(port_row, vlan_row);
         }
     }
@@ -282,42 +683,23 @@ bool ops_port_set_trunks(int64_t *trunk_vlan_ids,
                          const struct ovsrec_port *port_row,
                          struct ovsdb_idl *idl)
 {
-    const struct ovsrec_vlan *vlan_row = NULL;
-    struct ovsrec_vlan **vlan_trunks = NULL;
-    bool ret_val = false;
+    struct ops_vlan_bitmap trunks;
     int index;
 
-    if ((port_row != NULL) && (idl != NULL)) {
-        vlan_trunks = xmalloc(sizeof(struct ovsrec_vlan *)*trunk_vlan_count);
-        if(vlan_trunks != NULL) {
-            for (index = 0; index < trunk_vlan_count; index++) {
-                vlan_row = (const struct ovsrec_vlan *)
-                            ops_get_vlan_by_id(trunk_vlan_ids[index], idl);
-                if(vlan_row != NULL) {
-                    vlan_trunks[index] = (struct ovsrec_vlan *)vlan_row;
-                    ret_val = true;
-                }
-                else {
-                    ret_val = false;
-                    break;
-                }
-            }
-
-            if(trunk_vlan_count == 0) {
-                ret_val = true;
-            }
-
-            if(ret_val == true) {
-                ovsrec_port_set_vlan_trunks(port_row, vlan_trunks,
-                                            (size_t)trunk_vlan_count);
-            }
+    if ((port_row == NULL) || (idl == NULL)) {
+        return false;
+    }
 
-            free(vlan_trunks);
-            vlan_trunks = NULL;
+    ops_vlan_bitmap_init(&trunks);
+    for (index = 0; index < trunk_vlan_count; index++) {
+        if (ops_get_vlan_by_id(trunk_vlan_ids[index], idl) == NULL) {
+            return false;
         }
+        ops_vlan_bitmap_set(&trunks, trunk_vlan_ids[index]);
     }
 
-    return ret_val;
+    ops_port_update_trunks(port_row, &trunks, idl);
+    return true;
 }
 
 /******************************************************************************
@@ -348,7 +730,7 @@ bool ops_mac_set_vlan(int64_t vlan_id,
             ret_val = true;
         }
 
-        if(ret_val) {
+        if(ret_val && (mac_row->mac_vlan != vlan_row)) {
             ovsrec_mac_set_mac_vlan(mac_row, vlan_row);
         }
     }
@@ -426,6 +808,319 @@ int ops_mac_get_vlan(const struct ovsrec_mac *mac_row)
     return vlan_id;
 }
 
+/*
+ * Direct-indexed VLAN id to VLAN row table, rebuilt with a single scan of
+ * the VLAN table whenever the IDL sequence number changes, so that a free
+ * slot is a miss without looking further. Writes in an open transaction do
+ * not change the sequence number: rows inserted in it when the table is
+ * built are indexed by uuid, as they are freed if the transaction is
+ * aborted, and lookups check that the row found is still current. The
+ * table is shared by all IDLs and rebuilt when another one is passed, so
+ * it is not thread-safe.
+ */
+static struct {
+    const struct ovsdb_idl *idl;
+    unsigned int seqno;
+    bool valid;
+    const struct ovsrec_vlan *rows[OPS_VLAN_ID_COUNT];
+    struct ops_vlan_bitmap uncommitted;     /* Slots of inserted rows */
+    struct uuid uuids[OPS_VLAN_ID_COUNT];   /* Of the inserted rows */
+} ops_vlan_index;
+
+static void
+ops_vlan_index_refresh(struct ovsdb_idl *idl)
+{
+    const struct ovsrec_vlan *vlan_row = NULL;
+    unsigned int seqno = ovsdb_idl_get_seqno(idl);
+
+    if (ops_vlan_index.valid && ops_vlan_index.idl == idl &&
+        ops_vlan_index.seqno == seqno) {
+        return;
+    }
+
+    memset(ops_vlan_index.rows, 0, sizeof ops_vlan_index.rows);
+    ops_vlan_bitmap_init(&ops_vlan_index.uncommitted);
+    OVSREC_VLAN_FOR_EACH (vlan_row, idl) {
+        if ((vlan_row->id >= 0) && (vlan_row->id < OPS_VLAN_ID_COUNT) &&
+            (ops_vlan_index.rows[vlan_row->id] == NULL)) {
+            ops_vlan_index.rows[vlan_row->id] = vlan_row;
+            if (vlan_row->header_.old == NULL) {
+                ops_vlan_bitmap_set(&ops_vlan_index.uncommitted,
+                                    vlan_row->id);
+                ops_vlan_index.uuids[vlan_row->id] = vlan_row->header_.uuid;
+            }
+        }
+    }
+    ops_vlan_index.idl = idl;
+    ops_vlan_index.seqno = seqno;
+    ops_vlan_index.valid = true;
+}
+
+/* Returns the row indexed for a VLAN id between 0 and OPS_VLAN_ID_COUNT - 1
+ * if it is still current, else NULL. The index must be refreshed. */
+static const struct ovsrec_vlan *
+ops_vlan_index_get(int64_t vlan_id, struct ovsdb_idl *idl)
+{
+    const struct ovsrec_vlan *vlan_row = ops_vlan_index.rows[vlan_id];
+
+    if ((vlan_row != NULL) &&
+        ops_vlan_bitmap_is_set(&ops_vlan_index.uncommitted, vlan_id)) {
+        /* Gone if its transaction was aborted */
+        vlan_row = ovsrec_vlan_get_for_uuid(idl,
+                                            &ops_vlan_index.uuids[vlan_id]);
+    }
+
+    /* Neither deleted nor renumbered in the open transaction */
+    if ((vlan_row == NULL) || (vlan_row->header_.new == NULL) ||
+        (vlan_row->id != vlan_id)) {
+        return NULL;
+    }
+    return vlan_row;
+}
+
+/* Resolves a VLAN id between 0 and OPS_VLAN_ID_COUNT - 1 */
+static const struct ovsrec_vlan *
+ops_vlan_index_lookup(int64_t vlan_id, struct ovsdb_idl *idl)
+{
+    ops_vlan_index_refresh(idl);
+    return ops_vlan_index_get(vlan_id, idl);
+}
+
+/******************************************************************************
+ * Invalidates the VLAN id index used by ops_get_vlan_by_id
+ *****************************************************************************/
+void ops_vlan_index_invalidate(void)
+{
+    ops_vlan_index.valid = false;
+}
+
+/******************************************************************************
+ * Setter function for trunk column of port table taking a VLAN bitmap
+ *
+ * @param[in]  trunks   : set of VLANs to trunk on the port
+ * @param[in]  port_row : port table record for which trunked VLANs
+ *                        record has to be set
+ * @param[in]  idl      : pointer to ovsdb handler
+ *
+ * @return true for success, else false if any VLAN in trunks does not exist
+ *****************************************************************************/
+bool ops_port_set_trunks_bitmap(const struct ops_vlan_bitmap *trunks,
+                                const struct ovsrec_port *port_row,
+                                struct ovsdb_idl *idl)
+{
+    unsigned int vid;
+
+    if ((trunks == NULL) || (port_row == NULL) || (idl == NULL)) {
+        return false;
+    }
+
+    OPS_VLAN_BITMAP_FOR_EACH (vid, trunks) {
+        if (ops_vlan_index_lookup(vid, idl) == NULL) {
+            return false;
+        }
+    }
+
+    ops_port_update_trunks(port_row, trunks, idl);
+    return true;
+}
+
+/******************************************************************************
+ * Getter function for the trunk VLANs of a group of ports
+ *
+ * @param[in]  port_rows : port table records of the group
+ * @param[in]  n         : number of ports in port_rows
+ * @param[out] common    : VLANs trunked on every port, may be NULL
+ * @param[out] all       : VLANs trunked on any port, may be NULL
+ *****************************************************************************/
+void ops_port_group_get_trunks(const struct ovsrec_port *const *port_rows,
+                               size_t n,
+                               struct ops_vlan_bitmap *common,
+                               struct ops_vlan_bitmap *all)
+{
+    struct ops_vlan_bitmap trunks;
+    size_t index;
+
+    if (common != NULL) {
+        ops_vlan_bitmap_init(common);
+    }
+    if (all != NULL) {
+        ops_vlan_bitmap_init(all);
+    }
+
+    for (index = 0; index < n; index++) {
+        ops_port_get_trunks_bitmap(port_rows[index], &trunks);
+        if (common != NULL) {
+            if (index == 0) {
+                *common = trunks;
+            }
+            else {
+                ops_vlan_bitmap_intersect(common, common, &trunks);
+            }
+        }
+        if (all != NULL) {
+            ops_vlan_bitmap_union(all, all, &trunks);
+        }
+    }
+}
+
+/******************************************************************************
+ * Applies VLAN membership to many ports in the caller's transaction
+ *
+ * @param[in,out] assignments : ports and their VLANs, the ok member of each
+ *                              entry is set to the result for that port
+ * @param[in]     n           : number of entries in assignments
+ * @param[in]     idl         : pointer to ovsdb handler
+ *
+ * @return number of ports whose assignment was applied
+ *****************************************************************************/
+size_t ops_port_set_vlans(struct ops_port_vlan_assignment *assignments,
+                          size_t n,
+                          struct ovsdb_idl *idl)
+{
+    struct ops_port_vlan_assignment *assignment;
+    struct ops_vlan_bitmap existing, missing;
+    const struct ovsrec_vlan *vlan_row;
+    unsigned int vid;
+    size_t n_ok = 0;
+    size_t index;
+
+    if ((assignments == NULL) || (idl == NULL)) {
+        return 0;
+    }
+
+    /* Resolve the VLAN table once, so that checking a trunk set below is
+     * a fixed number of word operations whatever its size */
+    ops_vlan_index_refresh(idl);
+    ops_vlan_bitmap_init(&existing);
+    for (vid = 0; vid < OPS_VLAN_ID_COUNT; vid++) {
+        if (ops_vlan_index_get(vid, idl) != NULL) {
+            ops_vlan_bitmap_set(&existing, vid);
+        }
+    }
+
+    for (index = 0; index < n; index++) {
+        assignment = &assignments[index];
+        assignment->ok = false;
+
+        if (assignment->port_row == NULL) {
+            continue;
+        }
+
+        vlan_row = NULL;
+        if (assignment->access_vlan > 0) {
+            if (assignment->access_vlan >= OPS_VLAN_ID_COUNT) {
+                continue;
+            }
+            vlan_row = ops_vlan_index_lookup(assignment->access_vlan, idl);
+            if (vlan_row == NULL) {
+                continue;
+            }
+        }
+
+        if (assignment->trunks != NULL) {
+            ops_vlan_bitmap_difference(&missing, assignment->trunks,
+                                       &existing);
+            if (!ops_vlan_bitmap_is_empty(&missing)) {
+                continue;
+            }
+        }
+
+        if ((assignment->access_vlan >= 0) &&
+            (assignment->port_row->vlan_tag != vlan_row)) {
+            ovsrec_port_set_vlan_tag(assignment->port_row, vlan_row);
+        }
+        if (assignment->trunks != NULL) {
+            ops_port_update_trunks(assignment->port_row, assignment->trunks,
+                                   idl);
+        }
+
+        assignment->ok = true;
+        n_ok++;
+    }
+
+    return n_ok;
+}
+
+/******************************************************************************
+ * Getter function for trunk column of port table returning a VLAN bitmap
+ *
+ * @param[in]  port_row : port table record for which trunk VLANs have to be
+ *                        fetched
+ * @param[out] trunks   : set of VLANs trunked on the port
+ *****************************************************************************/
+void ops_port_get_trunks_bitmap(const struct ovsrec_port *port_row,
+                                struct ops_vlan_bitmap *trunks)
+{
+    size_t index;
+    int64_t vid;
+
+    ops_vlan_bitmap_init(trunks);
+    if ((port_row != NULL) && (port_row->vlan_trunks != NULL)) {
+        for (index = 0; index < port_row->n_vlan_trunks; index++) {
+            if (port_row->vlan_trunks[index] != NULL) {
+                vid = port_row->vlan_trunks[index]->id;
+                if ((vid >= 0) && (vid < OPS_VLAN_ID_COUNT)) {
+                    ops_vlan_bitmap_set(trunks, vid);
+                }
+            }
+        }
+    }
+}
+
+/*
+ * Updates the trunk column of port_row to hold exactly the VLANs in
+ * trunks, whose rows must exist. Nothing is written if the column already
+ * holds that set. When the IDL supports partial set updates and the change
+ * is smaller than the new set, only the added and removed VLANs are sent.
+ */
+static void
+ops_port_update_trunks(const struct ovsrec_port *port_row,
+                       const struct ops_vlan_bitmap *trunks,
+                       struct ovsdb_idl *idl)
+{
+    struct ovsrec_vlan *vlan_trunks[OPS_VLAN_ID_COUNT];
+    struct ops_vlan_bitmap current;
+    size_t n_vlan_trunks = 0;
+    unsigned int vid;
+#ifdef HAVE_OVSREC_PORT_UPDATE_VLAN_TRUNKS
+    struct ops_vlan_bitmap added, removed;
+    size_t index;
+    int64_t id;
+#endif
+
+    ops_port_get_trunks_bitmap(port_row, &current);
+    if (ops_vlan_bitmap_equal(&current, trunks)) {
+        return;
+    }
+
+#ifdef HAVE_OVSREC_PORT_UPDATE_VLAN_TRUNKS
+    ops_vlan_bitmap_difference(&added, trunks, &current);
+    ops_vlan_bitmap_difference(&removed, &current, trunks);
+    if (ops_vlan_bitmap_count(&added) + ops_vlan_bitmap_count(&removed) <
+        ops_vlan_bitmap_count(trunks)) {
+        for (index = 0; index < port_row->n_vlan_trunks; index++) {
+            id = port_row->vlan_trunks[index]->id;
+            if ((id >= 0) && (id < OPS_VLAN_ID_COUNT) &&
+                ops_vlan_bitmap_is_set(&removed, id)) {
+                ovsrec_port_update_vlan_trunks_delvalue(
+                    port_row, port_row->vlan_trunks[index]);
+            }
+        }
+        OPS_VLAN_BITMAP_FOR_EACH (vid, &added) {
+            ovsrec_port_update_vlan_trunks_addvalue(
+                port_row, ops_vlan_index_lookup(vid, idl));
+        }
+        return;
+    }
+#endif
+
+    OPS_VLAN_BITMAP_FOR_EACH (vid, trunks) {
+        vlan_trunks[n_vlan_trunks++] =
+            (struct ovsrec_vlan *) ops_vlan_index_lookup(vid, idl);
+    }
+    ovsrec_port_set_vlan_trunks(port_row, vlan_trunks, n_vlan_trunks);
+}
+
 /******************************************************************************
  * Setter function for tag column of port table
  *
@@ -438,13 +1133,210 @@ const struct ovsrec_vlan * ops_get_vlan_by_id(int vlan_id,
 {
     const struct ovsrec_vlan *vlan_row = NULL;
 
-    if(idl != NULL) {
-        OVSREC_VLAN_FOR_EACH (vlan_row, idl) {
-            if(vlan_id == vlan_row->id) {
-                break;
+    if ((idl != NULL) && (vlan_id >= 0) && (vlan_id < OPS_VLAN_ID_COUNT)) {
+        vlan_row = ops_vlan_index_lookup(vlan_id, idl);
+    }
+
+    return vlan_row;
+}
+
+/*
+ * VLAN id to member ports index. Each port's membership (tag and trunks)
+ * is remembered as a bitmap, so that a changed port only moves between the
+ * member sets of the VLANs it joined or left.
+ */
+struct ops_vlan_member_port {
+    struct hmap_node node;             /* In ops_vlan_members.ports */
+    struct uuid uuid;                  /* Port row uuid */
+    const struct ovsrec_port *port_row;
+    struct ops_vlan_bitmap vlans;      /* VLANs the port is a member of */
+};
+
+static struct {
+    const struct ovsdb_idl *idl;
+    unsigned int seqno;
+    bool valid;
+    struct hmap ports;                 /* Of struct ops_vlan_member_port */
+    struct hmapx members[OPS_VLAN_ID_COUNT]; /* Of ovsrec_port rows */
+} ops_vlan_members;
+
+static struct ops_vlan_member_port *
+ops_vlan_members_find_port(const struct ovsrec_port *port_row)
+{
+    struct ops_vlan_member_port *port;
+
+    HMAP_FOR_EACH_WITH_HASH (port, node, uuid_hash(&port_row->header_.uuid),
+                             &ops_vlan_members.ports) {
+        if (uuid_equals(&port->uuid, &port_row->header_.uuid)) {
+            return port;
+        }
+    }
+    return NULL;
+}
+
+/* Moves a port between member sets to match vlans, NULL removes it */
+static void
+ops_vlan_members_update_port(const struct ovsrec_port *port_row,
+                             const struct ops_vlan_bitmap *vlans)
+{
+    struct ops_vlan_member_port *port;
+    struct ops_vlan_bitmap changed;
+    unsigned int vid;
+
+    port = ops_vlan_members_find_port(port_row);
+    if (port == NULL) {
+        if (vlans == NULL) {
+            return;
+        }
+        port = xzalloc(sizeof *port);
+        port->uuid = port_row->header_.uuid;
+        hmap_insert(&ops_vlan_members.ports, &port->node,
+                    uuid_hash(&port->uuid));
+    }
+    port->port_row = port_row;
+
+    if (vlans == NULL) {
+        OPS_VLAN_BITMAP_FOR_EACH (vid, &port->vlans) {
+            hmapx_find_and_delete(&ops_vlan_members.members[vid], port_row);
+        }
+        hmap_remove(&ops_vlan_members.ports, &port->node);
+        free(port);
+        return;
+    }
+
+    ops_vlan_bitmap_difference(&changed, &port->vlans, vlans);
+    OPS_VLAN_BITMAP_FOR_EACH (vid, &changed) {
+        hmapx_find_and_delete(&ops_vlan_members.members[vid], port_row);
+    }
+    ops_vlan_bitmap_difference(&changed, vlans, &port->vlans);
+    OPS_VLAN_BITMAP_FOR_EACH (vid, &changed) {
+        hmapx_add(&ops_vlan_members.members[vid], (void *) port_row);
+    }
+    port->vlans = *vlans;
+}
+
+/* Computes the VLANs a port carries, as tag or trunk */
+static void
+ops_vlan_members_get_port_vlans(const struct ovsrec_port *port_row,
+                                struct ops_vlan_bitmap *vlans)
+{
+    int vid = ops_port_get_tag(port_row);
+
+    ops_port_get_trunks_bitmap(port_row, vlans);
+    if ((vid > 0) && (vid < OPS_VLAN_ID_COUNT)) {
+        ops_vlan_bitmap_set(vlans, vid);
+    }
+}
+
+static void
+ops_vlan_members_clear(void)
+{
+    struct ops_vlan_member_port *port;
+    int vid;
+
+    if (!ops_vlan_members.valid) {
+        return;
+    }
+    HMAP_FOR_EACH_POP (port, node, &ops_vlan_members.ports) {
+        free(port);
+    }
+    hmap_destroy(&ops_vlan_members.ports);
+    for (vid = 0; vid < OPS_VLAN_ID_COUNT; vid++) {
+        hmapx_destroy(&ops_vlan_members.members[vid]);
+    }
+    ops_vlan_members.valid = false;
+}
+
+/******************************************************************************
+ * Brings the VLAN member index up to date with the Port table
+ *****************************************************************************/
+void ops_vlan_members_run(struct ovsdb_idl *idl)
+{
+    const struct ovsrec_port *port_row = NULL;
+    struct ops_vlan_bitmap vlans;
+    unsigned int seqno;
+    unsigned int tracked_seqno = 0;
+    int vid;
+
+    if (idl == NULL) {
+        return;
+    }
+
+    seqno = ovsrec_port_get_seqno(idl);
+    if (ops_vlan_members.valid && ops_vlan_members.idl == idl) {
+        if (ops_vlan_members.seqno == seqno) {
+            return;
+        }
+        OVSREC_PORT_FOR_EACH_TRACKED (port_row, idl) {
+            if (ovsrec_port_row_get_seqno(port_row,
+                                          OVSDB_IDL_CHANGE_DELETE) > 0) {
+                ops_vlan_members_update_port(port_row, NULL);
             }
+            else {
+                ops_vlan_members_get_port_vlans(port_row, &vlans);
+                ops_vlan_members_update_port(port_row, &vlans);
+            }
+            tracked_seqno = MAX(tracked_seqno,
+                ovsrec_port_row_get_seqno(port_row, OVSDB_IDL_CHANGE_INSERT));
+            tracked_seqno = MAX(tracked_seqno,
+                ovsrec_port_row_get_seqno(port_row, OVSDB_IDL_CHANGE_MODIFY));
+            tracked_seqno = MAX(tracked_seqno,
+                ovsrec_port_row_get_seqno(port_row, OVSDB_IDL_CHANGE_DELETE));
+        }
+        /* The Port table seqno moves with every Port row change, tracked
+         * or not. If no tracked row accounts for the latest one, the VLAN
+         * columns are not tracked or the changes were cleared before this
+         * call, and the index can only be trusted after a rebuild. */
+        if (tracked_seqno >= seqno) {
+            ops_vlan_members.seqno = seqno;
+            return;
         }
     }
 
-    return vlan_row;
+    ops_vlan_members_clear();
+    hmap_init(&ops_vlan_members.ports);
+    for (vid = 0; vid < OPS_VLAN_ID_COUNT; vid++) {
+        hmapx_init(&ops_vlan_members.members[vid]);
+    }
+    ops_vlan_members.valid = true;
+
+    OVSREC_PORT_FOR_EACH (port_row, idl) {
+        ops_vlan_members_get_port_vlans(port_row, &vlans);
+        ops_vlan_members_update_port(port_row, &vlans);
+    }
+    ops_vlan_members.idl = idl;
+    ops_vlan_members.seqno = seqno;
+}
+
+/******************************************************************************
+ * Drops the VLAN member index
+ *****************************************************************************/
+void ops_vlan_members_invalidate(void)
+{
+    ops_vlan_members_clear();
+}
+
+/******************************************************************************
+ * Getter function for the ports carrying a VLAN
+ *****************************************************************************/
+const struct hmapx *ops_vlan_get_members(int vlan_id,
+                                         struct ovsdb_idl *idl)
+{
+    if ((idl == NULL) || (vlan_id < 0) || (vlan_id >= OPS_VLAN_ID_COUNT)) {
+        return NULL;
+    }
+
+    ops_vlan_members_run(idl);
+    return &ops_vlan_members.members[vlan_id];
+}
+
+/******************************************************************************
+ * Getter function for the number of ports carrying a VLAN
+ *****************************************************************************/
+size_t ops_vlan_get_member_count(int vlan_id,
+                                 struct ovsdb_idl *idl)
+{
+    const struct hmapx *members = ops_vlan_get_members(vlan_id, idl);
+
+    return members != NULL ? hmapx_count(members) : 0;
 }
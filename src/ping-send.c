@@ -16,17 +16,29 @@
  * File:ping_send.c
 */
 
+#define _GNU_SOURCE
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netinet/ip_icmp.h>
 #include <netinet/icmp6.h>
+#include <netdb.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <poll.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/timerfd.h>
+#include "hash.h"
+#include "hmap.h"
+#include "poll-loop.h"
+#include "util.h"
 #include "openvswitch/vlog.h"
 #include "ops-utils.h"
+#include "vrf-utils.h"
+#include "ping-send.h"
 
 #define DEFDATALEN  56
 #define MAXICMPLEN 76
@@ -34,6 +46,25 @@
 
 #define PACKETSIZE  64
 
+#define PING_BATCH       64            /* Echoes per sendmmsg/recvmmsg */
+#define PING_REPLY_SIZE  192           /* IP header, ICMP header and data */
+#define PING_RCVBUF      (4 * 1024 * 1024) /* Replies of a whole sweep */
+#define PING_ID_BITS     4             /* ICMP ids per engine, as a power of 2 */
+#define PING_IDS         (1 << PING_ID_BITS)
+#define PING_PROBE_MASK  ((1U << (16 + PING_ID_BITS)) - 1)
+#define PING_MAX_TARGETS PING_PROBE_MASK /* Probe numbers never all taken */
+
+#define PING_WHEEL_LEVELS  4
+#define PING_WHEEL_BITS    8
+#define PING_WHEEL_SLOTS   (1 << PING_WHEEL_BITS)
+#define PING_WHEEL_MASK    (PING_WHEEL_SLOTS - 1)
+#define PING_WHEEL_NONE    -1
+
+/* From linux/icmp.h, which clashes with netinet/ip_icmp.h */
+#ifndef ICMP_FILTER
+#define ICMP_FILTER      1
+#endif
+
 VLOG_DEFINE_THIS_MODULE(ping_util);
 
 struct packet
@@ -171,3 +202,1106 @@ int ping6(const char *target)
     }
     return 0;
 }
+
+/*
+ * Probe engine
+ *
+ * Targets are held in an array indexed by target id. While a probe is
+ * outstanding its target sits in the outstanding hmap, hashed on the
+ * number of the probe. A probe number packs the offset of the ICMP id in
+ * the engine's range of PING_IDS ids above the 16 bit sequence number, so
+ * that an engine can have up to PING_PROBE_MASK probes outstanding.
+ * Numbers are handed out in send order, so the outstanding probes are
+ * always the ones numbered from oldest_probe to next_probe and the oldest
+ * of them is the next to time out.
+ */
+
+/* Echo request, ICMP and ICMPv6 headers have the same layout */
+struct ping_echo {
+    union {
+        struct icmphdr icmp4;
+        struct icmp6_hdr icmp6;
+    } hdr;
+    char data[DEFDATALEN];
+};
+
+struct ping_target {
+    struct hmap_node node;             /* In outstanding, while probed */
+    int family;                        /* AF_INET or AF_INET6 */
+    union {
+        struct sockaddr_in in4;
+        struct sockaddr_in6 in6;
+    } addr;
+    bool outstanding;                  /* A probe awaits its reply */
+    bool reachable;                    /* Last completed probe got a reply */
+    uint32_t probe;                    /* Number of the probe */
+    uint64_t sent_ns;                  /* Send time of the probe */
+    struct ops_ping_stats stats;
+};
+
+struct ops_ping_engine {
+    int sock4;                         /* ICMP socket, or -1 */
+    int sock6;                         /* ICMPv6 socket, or -1 */
+    uint16_t base_id;                  /* First of the PING_IDS ICMP ids */
+    uint32_t next_probe;               /* Number of the next probe */
+    uint32_t oldest_probe;             /* Earlier probes have completed */
+    uint64_t timeout_ns;
+
+    struct ping_target **targets;      /* Indexed by id, NULL if free */
+    size_t n_targets;
+    size_t allocated_targets;
+    int *free_ids;                     /* Stack of free target ids */
+    size_t n_free_ids;
+    size_t allocated_free_ids;
+
+    struct hmap outstanding;           /* Of struct ping_target, by probe */
+};
+
+/* Echoes of one address family waiting to be sent together */
+struct ping_batch {
+    int family;
+    size_t n;
+    struct ping_target *targets[PING_BATCH];
+    struct ping_echo echoes[PING_BATCH];
+    struct iovec iovs[PING_BATCH];
+    struct mmsghdr msgs[PING_BATCH];
+};
+
+static inline uint64_t
+ping_timespec_ns(const struct timespec *ts)
+{
+    return (uint64_t) ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+static inline uint64_t
+ping_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ping_timespec_ns(&ts);
+}
+
+/* Opens a raw ICMP socket of the given family, in a VRF if ns_name is set */
+static int
+ping_engine_open_socket(const char *ns_name, int family, int protocol)
+{
+    struct vrf_sock_params params;
+    char *name;
+    int sock;
+
+    if (ns_name == NULL) {
+        sock = socket(family, SOCK_RAW, protocol);
+    }
+    else {
+        params.nl_params.family = family;
+        params.nl_params.type = SOCK_RAW;
+        params.nl_params.protocol = protocol;
+        name = xstrdup(ns_name);
+        sock = vrf_create_socket(name, &params);
+        free(name);
+    }
+    if (sock < 0) {
+        VLOG_ERR("can not create icmp%s socket. errstr = %s",
+                 family == AF_INET ? "4" : "6", strerror(errno));
+        return -1;
+    }
+    return sock;
+}
+
+/* Sizes the receive buffer for a sweep worth of replies, above
+ * net.core.rmem_max if the process is allowed to */
+static void
+ping_engine_set_rcvbuf(int sock, int size)
+{
+    if (setsockopt(sock, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof size)) {
+        setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof size);
+    }
+}
+
+struct ops_ping_engine *
+ops_ping_engine_create(const char *vrf_ns_name, unsigned int timeout_ms)
+{
+    static unsigned int n_created;
+    struct ops_ping_engine *engine;
+    struct icmp6_filter filter6;
+    uint32_t filter4;
+    const int ttl = 255;
+    const int on = 1;
+
+    engine = xzalloc(sizeof *engine);
+    engine->sock4 = ping_engine_open_socket(vrf_ns_name, AF_INET,
+                                            IPPROTO_ICMP);
+    engine->sock6 = ping_engine_open_socket(vrf_ns_name, AF_INET6,
+                                            IPPROTO_ICMPV6);
+    if ((engine->sock4 < 0) && (engine->sock6 < 0)) {
+        free(engine);
+        return NULL;
+    }
+
+    /* Only let echo replies in, the sockets would otherwise queue every
+     * ICMP packet the host receives. The kernel fills in the ICMPv6
+     * checksum and stamps each reply with its arrival time, which the RTT
+     * is measured to. */
+    if (engine->sock4 >= 0) {
+        filter4 = ~(1U << ICMP_ECHOREPLY);
+        setsockopt(engine->sock4, SOL_RAW, ICMP_FILTER, &filter4,
+                   sizeof filter4);
+        setsockopt(engine->sock4, SOL_IP, IP_TTL, &ttl, sizeof ttl);
+        ping_engine_set_rcvbuf(engine->sock4, PING_RCVBUF);
+        setsockopt(engine->sock4, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof on);
+    }
+    if (engine->sock6 >= 0) {
+        ICMP6_FILTER_SETBLOCKALL(&filter6);
+        ICMP6_FILTER_SETPASS(ICMP6_ECHO_REPLY, &filter6);
+        setsockopt(engine->sock6, IPPROTO_ICMPV6, ICMP6_FILTER, &filter6,
+                   sizeof filter6);
+        ping_engine_set_rcvbuf(engine->sock6, PING_RCVBUF);
+        setsockopt(engine->sock6, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof on);
+    }
+
+    /* Raw sockets see every echo reply of the host, the id tells ours.
+     * Engines of a process get disjoint, aligned ranges of ids. Only the
+     * low 12 bits of the pid fit, so processes whose pids are a multiple
+     * of 4096 apart share ids; the source address check keeps them from
+     * taking each other's replies unless they probe the same target. */
+    engine->base_id = (getpid() + 7919 * n_created++) << PING_ID_BITS;
+    engine->timeout_ns = (uint64_t) timeout_ms * 1000000;
+    hmap_init(&engine->outstanding);
+    return engine;
+}
+
+void
+ops_ping_engine_destroy(struct ops_ping_engine *engine)
+{
+    size_t i;
+
+    if (engine == NULL) {
+        return;
+    }
+    if (engine->sock4 >= 0) {
+        close(engine->sock4);
+    }
+    if (engine->sock6 >= 0) {
+        close(engine->sock6);
+    }
+    for (i = 0; i < engine->n_targets; i++) {
+        free(engine->targets[i]);
+    }
+    free(engine->targets);
+    free(engine->free_ids);
+    hmap_destroy(&engine->outstanding);
+    free(engine);
+}
+
+static struct ping_target *
+ping_engine_get_target(const struct ops_ping_engine *engine, int id)
+{
+    if ((id < 0) || ((size_t) id >= engine->n_targets)) {
+        return NULL;
+    }
+    return engine->targets[id];
+}
+
+int
+ops_ping_engine_add_target(struct ops_ping_engine *engine, const char *target)
+{
+    struct ping_target *new_target;
+    struct addrinfo hints, *res;
+    int id;
+
+    new_target = xzalloc(sizeof *new_target);
+    memset(&hints, 0, sizeof hints);
+    hints.ai_family = AF_INET6;
+    hints.ai_flags = AI_NUMERICHOST;
+    if (inet_pton(AF_INET, target, &new_target->addr.in4.sin_addr) == 1) {
+        new_target->family = AF_INET;
+        new_target->addr.in4.sin_family = AF_INET;
+    }
+    else if (getaddrinfo(target, NULL, &hints, &res) == 0) {
+        /* Unlike inet_pton, takes the zone of a link-local address */
+        memcpy(&new_target->addr.in6, res->ai_addr,
+               sizeof new_target->addr.in6);
+        freeaddrinfo(res);
+        if (!IN6_IS_ADDR_LINKLOCAL(&new_target->addr.in6.sin6_addr)
+            || new_target->addr.in6.sin6_scope_id) {
+            new_target->family = AF_INET6;
+        }
+    }
+    if ((new_target->family == AF_INET) ? (engine->sock4 < 0)
+        : (new_target->family != AF_INET6) || (engine->sock6 < 0)) {
+        VLOG_ERR("The given target_ip_add is not valid. target: %s", target);
+        free(new_target);
+        return -1;
+    }
+    if (engine->n_targets - engine->n_free_ids >= PING_MAX_TARGETS) {
+        VLOG_ERR("Too many ping targets, can not add %s", target);
+        free(new_target);
+        return -1;
+    }
+
+    if (engine->n_free_ids) {
+        id = engine->free_ids[--engine->n_free_ids];
+    }
+    else {
+        if (engine->n_targets == engine->allocated_targets) {
+            engine->targets = x2nrealloc(engine->targets,
+                                         &engine->allocated_targets,
+                                         sizeof *engine->targets);
+        }
+        id = engine->n_targets++;
+    }
+    engine->targets[id] = new_target;
+    return id;
+}
+
+bool
+ops_ping_engine_remove_target(struct ops_ping_engine *engine, int id)
+{
+    struct ping_target *target = ping_engine_get_target(engine, id);
+
+    if (target == NULL) {
+        return false;
+    }
+    if (target->outstanding) {
+        hmap_remove(&engine->outstanding, &target->node);
+    }
+    free(target);
+    engine->targets[id] = NULL;
+
+    if (engine->n_free_ids == engine->allocated_free_ids) {
+        engine->free_ids = x2nrealloc(engine->free_ids,
+                                      &engine->allocated_free_ids,
+                                      sizeof *engine->free_ids);
+    }
+    engine->free_ids[engine->n_free_ids++] = id;
+    return true;
+}
+
+static struct ping_target *
+ping_engine_find_outstanding(const struct ops_ping_engine *engine,
+                             uint32_t probe)
+{
+    struct ping_target *target;
+
+    HMAP_FOR_EACH_WITH_HASH (target, node, hash_int(probe, 0),
+                             &engine->outstanding) {
+        if (target->probe == probe) {
+            return target;
+        }
+    }
+    return NULL;
+}
+
+/* Ends the outstanding probe of a target, on a reply or a timeout */
+static void
+ping_engine_complete(struct ops_ping_engine *engine,
+                     struct ping_target *target, bool replied, uint64_t now)
+{
+    struct ops_ping_stats *stats = &target->stats;
+    uint64_t rtt_us;
+
+    hmap_remove(&engine->outstanding, &target->node);
+    target->outstanding = false;
+    target->reachable = replied;
+    if (!replied) {
+        stats->lost++;
+        return;
+    }
+
+    rtt_us = (now - target->sent_ns) / 1000;
+    stats->last_rtt_us = MIN(rtt_us, UINT32_MAX);
+    if ((stats->received == 0) || (stats->last_rtt_us < stats->min_rtt_us)) {
+        stats->min_rtt_us = stats->last_rtt_us;
+    }
+    stats->max_rtt_us = MAX(stats->max_rtt_us, stats->last_rtt_us);
+    stats->sum_rtt_us += stats->last_rtt_us;
+    stats->received++;
+}
+
+/* Returns the oldest outstanding probe, skipping the completed ones */
+static struct ping_target *
+ping_engine_oldest(struct ops_ping_engine *engine)
+{
+    struct ping_target *target;
+
+    for (; engine->oldest_probe != engine->next_probe;
+         engine->oldest_probe = (engine->oldest_probe + 1) & PING_PROBE_MASK) {
+        target = ping_engine_find_outstanding(engine, engine->oldest_probe);
+        if (target != NULL) {
+            return target;
+        }
+    }
+    return NULL;
+}
+
+static void
+ping_engine_expire(struct ops_ping_engine *engine, uint64_t now)
+{
+    struct ping_target *target;
+
+    while ((target = ping_engine_oldest(engine)) != NULL
+           && (now - target->sent_ns >= engine->timeout_ns)) {
+        ping_engine_complete(engine, target, false, now);
+    }
+}
+
+/* Starts a probe of target, numbering it and marking it outstanding */
+static void
+ping_engine_start_probe(struct ops_ping_engine *engine,
+                        struct ping_target *target, uint64_t now)
+{
+    struct ping_target *oldest;
+
+    if (target->outstanding) {
+        ping_engine_complete(engine, target, false, now);
+    }
+
+    /* Never reuse the number of an outstanding probe. There are more
+     * numbers than targets, so the window only fills up if its oldest probe
+     * went PING_PROBE_MASK sends without being expired, give up on it
+     * then. */
+    if (((engine->next_probe + 1) & PING_PROBE_MASK) == engine->oldest_probe) {
+        oldest = ping_engine_find_outstanding(engine, engine->oldest_probe);
+        if (oldest != NULL) {
+            ping_engine_complete(engine, oldest, false, now);
+        }
+        engine->oldest_probe = (engine->oldest_probe + 1) & PING_PROBE_MASK;
+    }
+
+    target->probe = engine->next_probe;
+    engine->next_probe = (engine->next_probe + 1) & PING_PROBE_MASK;
+    target->sent_ns = now;
+    target->outstanding = true;
+    hmap_insert(&engine->outstanding, &target->node,
+                hash_int(target->probe, 0));
+}
+
+/* Withdraws a probe that was not sent. If the send failed for the target
+ * itself, e.g. with no route to it, the target is unreachable; otherwise
+ * the socket was only short of buffers and the probe was not attempted. */
+static void
+ping_engine_abort_probe(struct ops_ping_engine *engine,
+                        struct ping_target *target, bool failed)
+{
+    hmap_remove(&engine->outstanding, &target->node);
+    target->outstanding = false;
+    if (failed) {
+        target->reachable = false;
+        target->stats.send_errors++;
+    }
+}
+
+static void
+ping_engine_build_echo(const struct ops_ping_engine *engine,
+                       const struct ping_target *target,
+                       struct ping_echo *echo)
+{
+    uint16_t id = engine->base_id + (target->probe >> 16);
+    uint16_t seq = target->probe & 0xffff;
+
+    memset(echo, 0, sizeof *echo);
+    if (target->family == AF_INET) {
+        echo->hdr.icmp4.type = ICMP_ECHO;
+        echo->hdr.icmp4.un.echo.id = htons(id);
+        echo->hdr.icmp4.un.echo.sequence = htons(seq);
+        echo->hdr.icmp4.checksum = checksum(echo, sizeof *echo);
+    }
+    else {
+        echo->hdr.icmp6.icmp6_type = ICMP6_ECHO_REQUEST;
+        echo->hdr.icmp6.icmp6_id = htons(id);
+        echo->hdr.icmp6.icmp6_seq = htons(seq);
+    }
+}
+
+/* Sends the echoes of a batch and empties it. Returns the number sent. */
+static size_t
+ping_engine_flush(struct ops_ping_engine *engine, struct ping_batch *batch)
+{
+    static struct vlog_rate_limit rl = VLOG_RATE_LIMIT_INIT(5, 20);
+    int sock = batch->family == AF_INET ? engine->sock4 : engine->sock6;
+    uint64_t now = ping_now_ns();
+    struct ping_target *target;
+    struct msghdr *msg;
+    size_t i, n_sent = 0;
+    int retval, error;
+
+    for (i = 0; i < batch->n; i++) {
+        target = batch->targets[i];
+        ping_engine_start_probe(engine, target, now);
+        ping_engine_build_echo(engine, target, &batch->echoes[i]);
+        batch->iovs[i].iov_base = &batch->echoes[i];
+        batch->iovs[i].iov_len = sizeof batch->echoes[i];
+
+        memset(&batch->msgs[i], 0, sizeof batch->msgs[i]);
+        msg = &batch->msgs[i].msg_hdr;
+        msg->msg_name = &target->addr;
+        msg->msg_namelen = target->family == AF_INET
+                           ? sizeof target->addr.in4
+                           : sizeof target->addr.in6;
+        msg->msg_iov = &batch->iovs[i];
+        msg->msg_iovlen = 1;
+    }
+
+    i = 0;
+    while (i < batch->n) {
+        retval = sendmmsg(sock, &batch->msgs[i], batch->n - i, MSG_DONTWAIT);
+        if (retval > 0) {
+            for (; retval > 0; retval--, i++) {
+                batch->targets[i]->stats.sent++;
+                n_sent++;
+            }
+            continue;
+        }
+
+        error = errno;
+        if (error == EINTR) {
+            continue;
+        }
+        VLOG_WARN_RL(&rl, "error:sendmmsg: errstr = %s", strerror(error));
+        if ((error == EAGAIN) || (error == ENOBUFS)) {
+            break;
+        }
+        /* Only this destination failed, e.g. no route to it */
+        ping_engine_abort_probe(engine, batch->targets[i++], true);
+    }
+    for (; i < batch->n; i++) {
+        ping_engine_abort_probe(engine, batch->targets[i], false);
+    }
+
+    batch->n = 0;
+    return n_sent;
+}
+
+bool
+ops_ping_engine_send(struct ops_ping_engine *engine, int id)
+{
+    struct ping_target *target = ping_engine_get_target(engine, id);
+    struct ping_batch batch;
+
+    if (target == NULL) {
+        return false;
+    }
+    batch.family = target->family;
+    batch.targets[0] = target;
+    batch.n = 1;
+    return ping_engine_flush(engine, &batch) == 1;
+}
+
+/* Sends an echo to the targets listed in ids, or to all if ids is NULL */
+static size_t
+ping_engine_send_batched(struct ops_ping_engine *engine, const int *ids,
+                         size_t n)
+{
+    struct ping_batch *batches, *batch;
+    struct ping_target *target;
+    size_t i, n_sent = 0;
+
+    /* IPv4 and IPv6 echoes */
+    batches = xmalloc(2 * sizeof *batches);
+    batches[0].family = AF_INET;
+    batches[0].n = 0;
+    batches[1].family = AF_INET6;
+    batches[1].n = 0;
+
+    for (i = 0; i < n; i++) {
+        target = ids ? ping_engine_get_target(engine, ids[i])
+                     : engine->targets[i];
+        if (target == NULL) {
+            continue;
+        }
+        batch = &batches[target->family == AF_INET6];
+        batch->targets[batch->n++] = target;
+        if (batch->n == PING_BATCH) {
+            n_sent += ping_engine_flush(engine, batch);
+        }
+    }
+    n_sent += ping_engine_flush(engine, &batches[0]);
+    n_sent += ping_engine_flush(engine, &batches[1]);
+
+    free(batches);
+    return n_sent;
+}
+
+size_t
+ops_ping_engine_send_many(struct ops_ping_engine *engine, const int *ids,
+                          size_t n)
+{
+    return ping_engine_send_batched(engine, ids, n);
+}
+
+size_t
+ops_ping_engine_send_all(struct ops_ping_engine *engine)
+{
+    return ping_engine_send_batched(engine, NULL, engine->n_targets);
+}
+
+static bool
+ping_engine_addr_equal(const struct ping_target *target,
+                       const struct sockaddr_in6 *from)
+{
+    const struct sockaddr_in *from4 = (const struct sockaddr_in *) from;
+
+    if (target->family == AF_INET) {
+        return from4->sin_addr.s_addr == target->addr.in4.sin_addr.s_addr;
+    }
+    return !memcmp(&from->sin6_addr, &target->addr.in6.sin6_addr,
+                   sizeof from->sin6_addr);
+}
+
+/* Matches one received packet to its probe, which arrived at the given
+ * time. Returns true on a match. */
+static bool
+ping_engine_handle_reply(struct ops_ping_engine *engine, int family,
+                         const uint8_t *packet, size_t len,
+                         const struct sockaddr_in6 *from, uint64_t arrival,
+                         uint64_t now)
+{
+    const struct icmphdr *icmp4;
+    const struct icmp6_hdr *icmp6;
+    struct ping_target *target;
+    uint16_t id, seq, offset;
+    size_t hlen;
+
+    if (family == AF_INET) {
+        /* IPv4 raw sockets get the IP header too */
+        hlen = len ? (packet[0] & 0x0f) * 4 : 0;
+        if ((hlen == 0) || (len < hlen + sizeof *icmp4)) {
+            return false;
+        }
+        icmp4 = (const struct icmphdr *) (packet + hlen);
+        if (icmp4->type != ICMP_ECHOREPLY) {
+            return false;
+        }
+        id = ntohs(icmp4->un.echo.id);
+        seq = ntohs(icmp4->un.echo.sequence);
+    }
+    else {
+        if (len < sizeof *icmp6) {
+            return false;
+        }
+        icmp6 = (const struct icmp6_hdr *) packet;
+        if (icmp6->icmp6_type != ICMP6_ECHO_REPLY) {
+            return false;
+        }
+        id = ntohs(icmp6->icmp6_id);
+        seq = ntohs(icmp6->icmp6_seq);
+    }
+
+    offset = id - engine->base_id;
+    if (offset >= PING_IDS) {
+        return false;
+    }
+    target = ping_engine_find_outstanding(engine,
+                                          ((uint32_t) offset << 16) | seq);
+    if ((target == NULL) || (target->family != family)
+        || !ping_engine_addr_equal(target, from)) {
+        return false;
+    }
+    /* Loopback replies can carry a stale stamp from before the probe */
+    if (arrival < target->sent_ns) {
+        arrival = now;
+    }
+    ping_engine_complete(engine, target, true, arrival);
+    return true;
+}
+
+/* Returns the monotonic arrival time of a reply from its SCM_TIMESTAMPNS,
+ * or now if it has none */
+static uint64_t
+ping_reply_time(struct msghdr *msg, uint64_t realtime_offset, uint64_t now)
+{
+    struct cmsghdr *cmsg;
+    struct timespec ts;
+    uint64_t arrival;
+
+    for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL;
+         cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        if ((cmsg->cmsg_level == SOL_SOCKET)
+            && (cmsg->cmsg_type == SCM_TIMESTAMPNS)) {
+            memcpy(&ts, CMSG_DATA(cmsg), sizeof ts);
+            arrival = ping_timespec_ns(&ts) - realtime_offset;
+            return MIN(arrival, now);
+        }
+    }
+    return now;
+}
+
+/* Reads all queued packets of a socket. Returns the replies matched. */
+static size_t
+ping_engine_receive(struct ops_ping_engine *engine, int sock, int family)
+{
+    struct ping_reply {
+        uint32_t packet[PING_REPLY_SIZE / 4];
+        struct sockaddr_in6 from;      /* Large enough for either family */
+        struct iovec iov;
+        union {
+            struct cmsghdr align;
+            char buf[CMSG_SPACE(sizeof(struct timespec))];
+        } control;
+    } *replies;
+    struct mmsghdr msgs[PING_BATCH];
+    size_t n_matched = 0;
+    uint64_t now, realtime_offset;
+    struct timespec ts;
+    int i, n;
+
+    replies = xmalloc(PING_BATCH * sizeof *replies);
+    for (;;) {
+        for (i = 0; i < PING_BATCH; i++) {
+            replies[i].iov.iov_base = replies[i].packet;
+            replies[i].iov.iov_len = sizeof replies[i].packet;
+            memset(&msgs[i], 0, sizeof msgs[i]);
+            msgs[i].msg_hdr.msg_name = &replies[i].from;
+            msgs[i].msg_hdr.msg_namelen = sizeof replies[i].from;
+            msgs[i].msg_hdr.msg_iov = &replies[i].iov;
+            msgs[i].msg_hdr.msg_iovlen = 1;
+            msgs[i].msg_hdr.msg_control = &replies[i].control;
+            msgs[i].msg_hdr.msg_controllen = sizeof replies[i].control;
+        }
+
+        n = recvmmsg(sock, msgs, PING_BATCH, MSG_DONTWAIT, NULL);
+        if (n <= 0) {
+            if ((n < 0) && (errno == EINTR)) {
+                continue;
+            }
+            break;
+        }
+        /* The kernel stamps replies with CLOCK_REALTIME, probes are timed
+         * on CLOCK_MONOTONIC */
+        now = ping_now_ns();
+        clock_gettime(CLOCK_REALTIME, &ts);
+        realtime_offset = ping_timespec_ns(&ts) - now;
+        for (i = 0; i < n; i++) {
+            n_matched += ping_engine_handle_reply(
+                engine, family, (const uint8_t *) replies[i].packet,
+                msgs[i].msg_len, &replies[i].from,
+                ping_reply_time(&msgs[i].msg_hdr, realtime_offset, now), now);
+        }
+        if (n < PING_BATCH) {
+            break;
+        }
+    }
+    free(replies);
+    return n_matched;
+}
+
+size_t
+ops_ping_engine_run(struct ops_ping_engine *engine)
+{
+    size_t n_matched = 0;
+
+    if (engine->sock4 >= 0) {
+        n_matched += ping_engine_receive(engine, engine->sock4, AF_INET);
+    }
+    if (engine->sock6 >= 0) {
+        n_matched += ping_engine_receive(engine, engine->sock6, AF_INET6);
+    }
+    ping_engine_expire(engine, ping_now_ns());
+    return n_matched;
+}
+
+void
+ops_ping_engine_wait(struct ops_ping_engine *engine)
+{
+    struct ping_target *oldest;
+    uint64_t now, deadline;
+
+    if (engine->sock4 >= 0) {
+        poll_fd_wait(engine->sock4, POLLIN);
+    }
+    if (engine->sock6 >= 0) {
+        poll_fd_wait(engine->sock6, POLLIN);
+    }
+
+    oldest = ping_engine_oldest(engine);
+    if (oldest != NULL) {
+        now = ping_now_ns();
+        deadline = oldest->sent_ns + engine->timeout_ns;
+        poll_timer_wait(deadline > now
+                        ? DIV_ROUND_UP(deadline - now, 1000000) : 0);
+    }
+}
+
+bool
+ops_ping_engine_get_stats(const struct ops_ping_engine *engine, int id,
+                          struct ops_ping_stats *stats)
+{
+    const struct ping_target *target = ping_engine_get_target(engine, id);
+
+    if (target == NULL) {
+        return false;
+    }
+    *stats = target->stats;
+    return true;
+}
+
+bool
+ops_ping_engine_is_reachable(const struct ops_ping_engine *engine, int id)
+{
+    const struct ping_target *target = ping_engine_get_target(engine, id);
+
+    return (target != NULL) && target->reachable;
+}
+
+/*
+ * Probe scheduler
+ *
+ * Timers live in an array indexed by target id and are chained by index
+ * in the slots of the wheel. A timer due delta ticks from now sits in
+ * level L, the lowest with delta < 256^(L+1), at the slot given by bits
+ * 8L to 8L+7 of its expiry tick. When the ticks reach a slot of level L
+ * its timers are cascaded down to the lower levels, and the timers of the
+ * current level 0 slot are due. The timerfd is armed once, for the next
+ * tick with a slot to process, and a run jumps straight over the ticks
+ * in between.
+ */
+
+struct ping_timer {
+    int next;                          /* Next timer of the slot */
+    int prev;                          /* Previous timer of the slot */
+    int slot;                          /* Slot index, PING_WHEEL_NONE if
+                                        * not scheduled */
+    uint32_t interval;                 /* In ticks */
+    uint64_t expires;                  /* Tick of the next probe */
+};
+
+struct ops_ping_scheduler {
+    struct ops_ping_engine *engine;
+    int timer_fd;
+    bool armed;                        /* timer_fd is set */
+    uint64_t armed_tick;               /* Tick timer_fd is set for */
+    uint64_t tick_ns;
+    uint64_t start_ns;                 /* Time of tick 0 */
+    uint64_t now_tick;                 /* Last tick processed */
+    uint32_t phase;                    /* Offset sequence of new timers */
+
+    int slots[PING_WHEEL_LEVELS * PING_WHEEL_SLOTS];
+    struct ping_timer *timers;         /* Indexed by target id */
+    size_t allocated_timers;
+    size_t n_scheduled;
+
+    int *due;                          /* Ids due at the current tick */
+    size_t allocated_due;
+};
+
+struct ops_ping_scheduler *
+ops_ping_scheduler_create(struct ops_ping_engine *engine,
+                          unsigned int tick_ms)
+{
+    struct ops_ping_scheduler *sched;
+    int fd, i;
+
+    fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (fd < 0) {
+        VLOG_ERR("can not create timerfd. errstr = %s", strerror(errno));
+        return NULL;
+    }
+
+    sched = xzalloc(sizeof *sched);
+    sched->engine = engine;
+    sched->timer_fd = fd;
+    sched->tick_ns = (uint64_t) MAX(tick_ms, 1) * 1000000;
+    sched->start_ns = ping_now_ns();
+    for (i = 0; i < PING_WHEEL_LEVELS * PING_WHEEL_SLOTS; i++) {
+        sched->slots[i] = PING_WHEEL_NONE;
+    }
+    return sched;
+}
+
+void
+ops_ping_scheduler_destroy(struct ops_ping_scheduler *sched)
+{
+    if (sched == NULL) {
+        return;
+    }
+    close(sched->timer_fd);
+    free(sched->timers);
+    free(sched->due);
+    free(sched);
+}
+
+/* Sets the timerfd to go off at tick, or stops it if tick is UINT64_MAX */
+static void
+ping_scheduler_arm(struct ops_ping_scheduler *sched, uint64_t tick)
+{
+    struct itimerspec its;
+    uint64_t ns;
+
+    memset(&its, 0, sizeof its);
+    if (tick != UINT64_MAX) {
+        ns = sched->start_ns + tick * sched->tick_ns;
+        its.it_value.tv_sec = ns / 1000000000;
+        its.it_value.tv_nsec = ns % 1000000000;
+    }
+    else if (!sched->armed) {
+        return;
+    }
+    if (timerfd_settime(sched->timer_fd, TFD_TIMER_ABSTIME, &its, NULL)) {
+        VLOG_ERR("error:timerfd_settime: errstr = %s", strerror(errno));
+        return;
+    }
+    sched->armed = tick != UINT64_MAX;
+    sched->armed_tick = tick;
+}
+
+static uint64_t
+ping_scheduler_current_tick(const struct ops_ping_scheduler *sched)
+{
+    return (ping_now_ns() - sched->start_ns) / sched->tick_ns;
+}
+
+/* Puts a timer in the slot matching its expiry, which is after now_tick */
+static void
+ping_scheduler_link(struct ops_ping_scheduler *sched, int id)
+{
+    struct ping_timer *timer = &sched->timers[id];
+    uint64_t delta = timer->expires - sched->now_tick;
+    int level, slot;
+
+    for (level = 0; level < PING_WHEEL_LEVELS - 1; level++) {
+        if (delta < (uint64_t) 1 << (PING_WHEEL_BITS * (level + 1))) {
+            break;
+        }
+    }
+    if (delta >> (PING_WHEEL_BITS * PING_WHEEL_LEVELS)) {
+        /* Beyond the wheel, park in the last slot to be reached */
+        timer->expires = sched->now_tick
+                         + ((uint64_t) 1 << (PING_WHEEL_BITS
+                                             * PING_WHEEL_LEVELS)) - 1;
+    }
+
+    slot = level * PING_WHEEL_SLOTS
+           + ((timer->expires >> (PING_WHEEL_BITS * level)) & PING_WHEEL_MASK);
+    timer->slot = slot;
+    timer->prev = PING_WHEEL_NONE;
+    timer->next = sched->slots[slot];
+    if (timer->next != PING_WHEEL_NONE) {
+        sched->timers[timer->next].prev = id;
+    }
+    sched->slots[slot] = id;
+}
+
+static void
+ping_scheduler_unlink(struct ops_ping_scheduler *sched, int id)
+{
+    struct ping_timer *timer = &sched->timers[id];
+
+    if (timer->prev != PING_WHEEL_NONE) {
+        sched->timers[timer->prev].next = timer->next;
+    }
+    else {
+        sched->slots[timer->slot] = timer->next;
+    }
+    if (timer->next != PING_WHEEL_NONE) {
+        sched->timers[timer->next].prev = timer->prev;
+    }
+    timer->slot = PING_WHEEL_NONE;
+}
+
+/* Empties a slot, returning the chain of its timers */
+static int
+ping_scheduler_take_slot(struct ops_ping_scheduler *sched, int slot)
+{
+    int head = sched->slots[slot];
+
+    sched->slots[slot] = PING_WHEEL_NONE;
+    return head;
+}
+
+static bool
+ping_scheduler_is_scheduled(const struct ops_ping_scheduler *sched, int id)
+{
+    return (id >= 0) && ((size_t) id < sched->allocated_timers)
+           && (sched->timers[id].slot != PING_WHEEL_NONE);
+}
+
+/* Returns the first tick after now_tick with a non-empty slot to expire or
+ * cascade, or UINT64_MAX if the wheel is empty */
+static uint64_t
+ping_scheduler_next_tick(const struct ops_ping_scheduler *sched)
+{
+    uint64_t next = UINT64_MAX;
+    uint64_t base, tick;
+    int level, i, shift;
+
+    for (i = 1; i <= PING_WHEEL_SLOTS; i++) {
+        tick = sched->now_tick + i;
+        if (sched->slots[tick & PING_WHEEL_MASK] != PING_WHEEL_NONE) {
+            next = tick;
+            break;
+        }
+    }
+
+    /* Higher levels are reached when the bits below them wrap */
+    for (level = 1; level < PING_WHEEL_LEVELS; level++) {
+        shift = PING_WHEEL_BITS * level;
+        base = sched->now_tick >> shift;
+        for (i = 1; i <= PING_WHEEL_SLOTS; i++) {
+            tick = (base + i) << shift;
+            if (tick >= next) {
+                break;
+            }
+            if (sched->slots[level * PING_WHEEL_SLOTS
+                             + ((base + i) & PING_WHEEL_MASK)]
+                != PING_WHEEL_NONE) {
+                next = tick;
+                break;
+            }
+        }
+    }
+    return next;
+}
+
+bool
+ops_ping_scheduler_add(struct ops_ping_scheduler *sched, int id,
+                       unsigned int interval_ms)
+{
+    uint64_t interval_ns = (uint64_t) interval_ms * 1000000;
+    struct ping_timer *timer;
+    size_t old_allocated;
+    uint64_t interval;
+
+    if ((id < 0) || (interval_ms == 0)) {
+        return false;
+    }
+    while ((size_t) id >= sched->allocated_timers) {
+        old_allocated = sched->allocated_timers;
+        sched->timers = x2nrealloc(sched->timers, &sched->allocated_timers,
+                                   sizeof *sched->timers);
+        for (; old_allocated < sched->allocated_timers; old_allocated++) {
+            sched->timers[old_allocated].slot = PING_WHEEL_NONE;
+        }
+    }
+
+    if (ping_scheduler_is_scheduled(sched, id)) {
+        ping_scheduler_unlink(sched, id);
+        sched->n_scheduled--;
+    }
+    if (sched->n_scheduled == 0) {
+        /* Nothing to cascade, skip the idle ticks */
+        sched->now_tick = ping_scheduler_current_tick(sched);
+    }
+
+    interval = DIV_ROUND_UP(interval_ns, sched->tick_ns);
+    timer = &sched->timers[id];
+    timer->interval = MIN(interval, UINT32_MAX);
+
+    /* Offset the first probe by the golden ratio sequence, so that the
+     * probes of targets added together are evenly spread */
+    sched->phase += 0x9e3779b9;
+    timer->expires = sched->now_tick + 1
+                     + (((uint64_t) sched->phase * timer->interval) >> 32);
+    ping_scheduler_link(sched, id);
+    sched->n_scheduled++;
+    if (!sched->armed || (timer->expires < sched->armed_tick)) {
+        ping_scheduler_arm(sched, timer->expires);
+    }
+    return true;
+}
+
+bool
+ops_ping_scheduler_remove(struct ops_ping_scheduler *sched, int id)
+{
+    if (!ping_scheduler_is_scheduled(sched, id)) {
+        return false;
+    }
+    ping_scheduler_unlink(sched, id);
+    if (--sched->n_scheduled == 0) {
+        ping_scheduler_arm(sched, UINT64_MAX);
+    }
+    return true;
+}
+
+/* Processes the tick after now_tick, appending the ids that are due to
+ * sched->due. Due timers are rescheduled after last_tick, the tick the
+ * run catches up to. */
+static void
+ping_scheduler_tick(struct ops_ping_scheduler *sched, uint64_t last_tick,
+                    size_t *n_due)
+{
+    struct ping_timer *timer;
+    uint64_t tick = ++sched->now_tick;
+    int level, id, next;
+
+    /* Cascade from the top, so that timers moving down more than one level
+     * are cascaded again on their way */
+    for (level = PING_WHEEL_LEVELS - 1; level > 0; level--) {
+        if (tick & (((uint64_t) 1 << (PING_WHEEL_BITS * level)) - 1)) {
+            continue;
+        }
+        id = ping_scheduler_take_slot(
+            sched, level * PING_WHEEL_SLOTS
+                   + ((tick >> (PING_WHEEL_BITS * level)) & PING_WHEEL_MASK));
+        for (; id != PING_WHEEL_NONE; id = next) {
+            next = sched->timers[id].next;
+            ping_scheduler_link(sched, id);
+        }
+    }
+
+    id = ping_scheduler_take_slot(sched, tick & PING_WHEEL_MASK);
+    for (; id != PING_WHEEL_NONE; id = next) {
+        timer = &sched->timers[id];
+        next = timer->next;
+
+        if (*n_due == sched->allocated_due) {
+            sched->due = x2nrealloc(sched->due, &sched->allocated_due,
+                                    sizeof *sched->due);
+        }
+        sched->due[(*n_due)++] = id;
+
+        /* Keep the phase of the target, skipping the probes missed if the
+         * daemon was held up. The next probe is always after last_tick, so
+         * a timer comes due at most once per run. */
+        timer->expires += timer->interval;
+        if (timer->expires <= last_tick) {
+            timer->expires = last_tick + timer->interval
+                             - (last_tick - timer->expires) % timer->interval;
+        }
+        /* This probe goes out at last_tick. If it is so late that the next
+         * one would follow within half an interval, and so push it out as
+         * lost, restart the phase of the target from it instead. */
+        if (timer->expires - last_tick < timer->interval / 2) {
+            timer->expires = last_tick + timer->interval;
+        }
+        ping_scheduler_link(sched, id);
+    }
+}
+
+size_t
+ops_ping_scheduler_run(struct ops_ping_scheduler *sched)
+{
+    uint64_t expirations, tick, next;
+    size_t n_due = 0;
+
+    /* The count is not needed, the ticks are taken from the clock */
+    if (read(sched->timer_fd, &expirations, sizeof expirations) < 0
+        && errno != EAGAIN) {
+        VLOG_ERR("error:read timerfd: errstr = %s", strerror(errno));
+    }
+
+    tick = ping_scheduler_current_tick(sched);
+    if (sched->n_scheduled == 0) {
+        sched->now_tick = tick;
+        return 0;
+    }
+
+    /* Only the ticks with a slot to process are worth stepping through */
+    while ((next = ping_scheduler_next_tick(sched)) <= tick) {
+        sched->now_tick = next - 1;
+        ping_scheduler_tick(sched, tick, &n_due);
+    }
+    sched->now_tick = MAX(sched->now_tick, tick);
+    ping_scheduler_arm(sched, next);
+
+    return n_due ? ops_ping_engine_send_many(sched->engine, sched->due, n_due)
+                 : 0;
+}
+
+void
+ops_ping_scheduler_wait(struct ops_ping_scheduler *sched)
+{
+    if (sched->armed) {
+        poll_fd_wait(sched->timer_fd, POLLIN);
+    }
+}
@@ -0,0 +1,832 @@
+/*
+ Copyright (C) 2016 Hewlett-Packard Development Company, L.P.
+ All Rights Reserved.
+
+    Licensed under the Apache License, Version 2.0 (the "License"); you may
+    not use this file except in compliance with the License. You may obtain
+    a copy of the License at
+
+         http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+    WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+    License for the specific language governing permissions and limitations
+    under the License.
+*/
+
+/*************************************************************************//**
+ * @ingroup sort_utils
+ * This module contains the DEFINES and functions that comprise the
+ * sort-utils library.
+ *
+ * @file
+ * Source file for sort-utils library.
+ *
+ ****************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <endian.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "util.h"
+#include "ops-utils.h"
+#include "sort-utils.h"
+
+typedef int sort_cmp_func(const void *, const void *);
+
+/*****************************************************************************
+ *                          Key radix sort                                   *
+ *****************************************************************************/
+
+/* A node and its extracted key */
+struct sort_key_entry {
+    uint64_t key;
+    const struct shash_node *node;
+    const void *aux;                   /* Tie-break data of the node */
+};
+
+/*
+ * Sorts entries by key with one counting pass per byte, least significant
+ * first. All byte histograms are taken in a single scan, and bytes that
+ * are the same in every key are skipped. Returns the array holding the
+ * result, entries or tmp.
+ */
+static struct sort_key_entry *
+sort_radix(struct sort_key_entry *entries, struct sort_key_entry *tmp,
+           size_t n)
+{
+    size_t (*counts)[256] = xcalloc(8, sizeof *counts);
+    struct sort_key_entry *src = entries, *dst = tmp, *swap;
+    size_t i, sum, count;
+    int byte, shift;
+
+    for (i = 0; i < n; i++) {
+        for (byte = 0; byte < 8; byte++) {
+            counts[byte][(entries[i].key >> (byte * 8)) & 0xff]++;
+        }
+    }
+
+    for (byte = 0; byte < 8; byte++) {
+        shift = byte * 8;
+        if (counts[byte][(entries[0].key >> shift) & 0xff] == n) {
+            continue;
+        }
+        for (sum = 0, i = 0; i < 256; i++) {
+            count = counts[byte][i];
+            counts[byte][i] = sum;
+            sum += count;
+        }
+        for (i = 0; i < n; i++) {
+            dst[counts[byte][(src[i].key >> shift) & 0xff]++] = src[i];
+        }
+        swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    free(counts);
+    return src;
+}
+
+/*
+ * For each run of equal keys in the n sorted entries, sorts the matching
+ * elements of base, an array of n elements of the given size, with cmp.
+ * base may be the entries themselves.
+ */
+static void
+sort_ties(const struct sort_key_entry *sorted, size_t n,
+          void *base, size_t size, sort_cmp_func *cmp)
+{
+    size_t i, run;
+
+    for (i = 0; i < n; i += run) {
+        for (run = 1; (i + run < n) && (sorted[i + run].key ==
+                                        sorted[i].key); run++) {
+            continue;
+        }
+        if (run > 1) {
+            qsort((char *) base + i * size, run, size, cmp);
+        }
+    }
+}
+
+int
+ops_sort_by_key(const struct shash *sh, ops_sort_key_func *key_func,
+                void *ptr_func_sort, const struct shash_node **sorted_list)
+{
+    sort_cmp_func *cmp = (sort_cmp_func *) ptr_func_sort;
+    struct sort_key_entry *entries, *sorted;
+    struct shash_node *node;
+    size_t i, n;
+
+    if ((key_func == NULL) || (sorted_list == NULL) || shash_is_empty(sh)) {
+        return 1;
+    }
+
+    n = shash_count(sh);
+    entries = xmalloc(2 * n * sizeof *entries);
+    i = 0;
+    SHASH_FOR_EACH (node, sh) {
+        entries[i].key = key_func(node);
+        entries[i].node = node;
+        i++;
+    }
+    ovs_assert(i == n);
+
+    sorted = sort_radix(entries, entries + n, n);
+    for (i = 0; i < n; i++) {
+        sorted_list[i] = sorted[i].node;
+    }
+
+    /* Order the nodes the keys could not tell apart */
+    if (cmp != NULL) {
+        sort_ties(sorted, n, sorted_list, sizeof *sorted_list, cmp);
+    }
+
+    free(entries);
+    return 0;
+}
+
+uint64_t
+ops_sort_key_name_prefix(const struct shash_node *node)
+{
+    uint64_t key = 0;
+
+    /* Zero padding keeps shorter names first, as strcmp does */
+    memcpy(&key, node->name, strnlen(node->name, sizeof key));
+    return be64toh(key);
+}
+
+uint64_t
+ops_sort_key_name_number(const struct shash_node *node)
+{
+    const char *p = node->name;
+    uint64_t value = 0;
+
+    if (*p == '\0') {
+        return UINT64_MAX;
+    }
+    for (; *p; p++) {
+        if ((*p < '0') || (*p > '9') || (value > (UINT64_MAX - 9) / 10)) {
+            return UINT64_MAX;
+        }
+        value = value * 10 + (*p - '0');
+    }
+    return value;
+}
+
+/*****************************************************************************
+ *                          Natural order                                    *
+ *****************************************************************************/
+
+/* Digits packed into one number, so that the value fits in 64 bits */
+#define SORT_NATURAL_DIGITS_MAX  19
+
+/*
+ * A digit run is encoded as '0' + n followed by the n value bytes, n being
+ * 1 to 8. That first byte stays in the '0'-'9' range, where no other key
+ * byte can be, so numbers keep their place relative to other characters.
+ */
+size_t
+ops_sort_natural_key(const char *name, uint8_t *key)
+{
+    const unsigned char *p = (const unsigned char *) name;
+    size_t len = 0, n_bytes, digits;
+    uint64_t value;
+
+    while (*p && (len < OPS_SORT_NATURAL_KEY_MAX)) {
+        if ((*p < '0') || (*p > '9')) {
+            key[len++] = *p++;
+            continue;
+        }
+
+        value = 0;
+        for (digits = 0; (*p >= '0') && (*p <= '9') &&
+                         (digits < SORT_NATURAL_DIGITS_MAX); digits++) {
+            value = value * 10 + (*p++ - '0');
+        }
+        for (n_bytes = 1; (n_bytes < 8) && (value >> (n_bytes * 8));
+             n_bytes++) {
+            continue;
+        }
+        if (len + 1 + n_bytes > OPS_SORT_NATURAL_KEY_MAX) {
+            break;
+        }
+        key[len++] = '0' + n_bytes;
+        while (n_bytes--) {
+            key[len++] = value >> (n_bytes * 8);
+        }
+    }
+    return len;
+}
+
+/* Natural-order key of a node, stored after the header */
+struct sort_natural_key {
+    size_t len;
+    uint8_t bytes[];
+};
+
+static int
+sort_natural_key_cmp(const uint8_t *a, size_t a_len,
+                     const uint8_t *b, size_t b_len)
+{
+    int cmp = memcmp(a, b, MIN(a_len, b_len));
+
+    return cmp ? cmp : (a_len > b_len) - (a_len < b_len);
+}
+
+int
+ops_sort_natural_compare(const void *a_, const void *b_)
+{
+    const struct shash_node *a = *(const struct shash_node **) a_;
+    const struct shash_node *b = *(const struct shash_node **) b_;
+    uint8_t a_key[OPS_SORT_NATURAL_KEY_MAX], b_key[OPS_SORT_NATURAL_KEY_MAX];
+    size_t a_len = ops_sort_natural_key(a->name, a_key);
+    size_t b_len = ops_sort_natural_key(b->name, b_key);
+    int cmp = sort_natural_key_cmp(a_key, a_len, b_key, b_len);
+
+    return cmp ? cmp : strcmp(a->name, b->name);
+}
+
+static int
+sort_natural_tie(const void *a_, const void *b_)
+{
+    const struct sort_key_entry *a = a_, *b = b_;
+    const struct sort_natural_key *a_key = a->aux, *b_key = b->aux;
+    int cmp = sort_natural_key_cmp(a_key->bytes, a_key->len,
+                                   b_key->bytes, b_key->len);
+
+    return cmp ? cmp : strcmp(a->node->name, b->node->name);
+}
+
+int
+ops_sort_natural(const struct shash *sh,
+                 const struct shash_node **sorted_list)
+{
+    struct sort_key_entry *entries, *sorted;
+    struct sort_natural_key *key;
+    struct shash_node *node;
+    size_t stride, i, n;
+    uint8_t *keys;
+
+    if ((sorted_list == NULL) || shash_is_empty(sh)) {
+        return 1;
+    }
+
+    n = shash_count(sh);
+    stride = ROUND_UP(sizeof *key + OPS_SORT_NATURAL_KEY_MAX,
+                      sizeof(size_t));
+    keys = xmalloc(n * stride);
+    entries = xmalloc(2 * n * sizeof *entries);
+    i = 0;
+    SHASH_FOR_EACH (node, sh) {
+        key = (struct sort_natural_key *) (keys + i * stride);
+        key->len = ops_sort_natural_key(node->name, key->bytes);
+
+        /* Zero padding keeps shorter keys first */
+        entries[i].key = 0;
+        memcpy(&entries[i].key, key->bytes, MIN(key->len, 8));
+        entries[i].key = be64toh(entries[i].key);
+        entries[i].node = node;
+        entries[i].aux = key;
+        i++;
+    }
+    ovs_assert(i == n);
+
+    sorted = sort_radix(entries, entries + n, n);
+    sort_ties(sorted, n, sorted, sizeof *sorted, sort_natural_tie);
+    for (i = 0; i < n; i++) {
+        sorted_list[i] = sorted[i].node;
+    }
+
+    free(entries);
+    free(keys);
+    return 0;
+}
+
+/*****************************************************************************
+ *                          Top K                                            *
+ *****************************************************************************/
+
+/* Restores the max-heap order of heap[0..n) below pos */
+static void
+sort_heap_sift_down(const struct shash_node **heap, size_t n, size_t pos,
+                    sort_cmp_func *cmp)
+{
+    const struct shash_node *node = heap[pos];
+    size_t child;
+
+    while ((child = 2 * pos + 1) < n) {
+        if ((child + 1 < n) && (cmp(&heap[child + 1], &heap[child]) > 0)) {
+            child++;
+        }
+        if (cmp(&heap[child], &node) <= 0) {
+            break;
+        }
+        heap[pos] = heap[child];
+        pos = child;
+    }
+    heap[pos] = node;
+}
+
+static void
+sort_heap_sift_up(const struct shash_node **heap, size_t pos,
+                  sort_cmp_func *cmp)
+{
+    const struct shash_node *node = heap[pos];
+    size_t parent;
+
+    while (pos > 0) {
+        parent = (pos - 1) / 2;
+        if (cmp(&heap[parent], &node) >= 0) {
+            break;
+        }
+        heap[pos] = heap[parent];
+        pos = parent;
+    }
+    heap[pos] = node;
+}
+
+int
+ops_sort_top_k(const struct shash *sh, void *ptr_func_sort,
+               const struct shash_node *after, size_t k,
+               const struct shash_node **sorted_list, size_t *n)
+{
+    sort_cmp_func *cmp = (sort_cmp_func *) ptr_func_sort;
+    const struct shash_node *candidate;
+    struct shash_node *node;
+    size_t n_heap = 0;
+
+    if (n != NULL) {
+        *n = 0;
+    }
+    if ((cmp == NULL) || (sorted_list == NULL) || (n == NULL)) {
+        return 1;
+    }
+    if ((k == 0) || shash_is_empty(sh)) {
+        return 0;
+    }
+
+    /* sorted_list is a max-heap of the k smallest nodes seen so far */
+    SHASH_FOR_EACH (node, sh) {
+        candidate = node;
+        if ((after != NULL) && (cmp(&candidate, &after) <= 0)) {
+            continue;
+        }
+        if (n_heap < k) {
+            sorted_list[n_heap] = candidate;
+            sort_heap_sift_up(sorted_list, n_heap++, cmp);
+        }
+        else if (cmp(&candidate, &sorted_list[0]) < 0) {
+            sorted_list[0] = candidate;
+            sort_heap_sift_down(sorted_list, n_heap, 0, cmp);
+        }
+    }
+
+    /* Heap sort in place, moving the largest to the end each time */
+    *n = n_heap;
+    while (n_heap > 1) {
+        candidate = sorted_list[--n_heap];
+        sorted_list[n_heap] = sorted_list[0];
+        sorted_list[0] = candidate;
+        sort_heap_sift_down(sorted_list, n_heap, 0, cmp);
+    }
+    return 0;
+}
+
+/*****************************************************************************
+ *                          Parallel sort                                    *
+ *****************************************************************************/
+
+/* One unit of work of a parallel sort phase */
+struct sort_task {
+    const struct shash_node **a;       /* Run to sort, or first run */
+    size_t a_n;
+    const struct shash_node **b;       /* Second run, NULL to sort a */
+    size_t b_n;
+    const struct shash_node **out;     /* Merge output */
+};
+
+/* Tasks run by all threads, each taking the next one until none is left */
+struct sort_phase {
+    struct sort_task *tasks;
+    size_t n_tasks;
+    size_t next;
+    sort_cmp_func *cmp;
+};
+
+/* Stable merge, taking from a first on equal nodes */
+static void
+sort_merge(const struct sort_task *task, sort_cmp_func *cmp)
+{
+    const struct shash_node **a = task->a, **a_end = a + task->a_n;
+    const struct shash_node **b = task->b, **b_end = b + task->b_n;
+    const struct shash_node **out = task->out;
+
+    while ((a < a_end) && (b < b_end)) {
+        *out++ = (cmp(b, a) < 0) ? *b++ : *a++;
+    }
+    memcpy(out, a, (a_end - a) * sizeof *a);
+    out += a_end - a;
+    memcpy(out, b, (b_end - b) * sizeof *b);
+}
+
+/* Runs the tasks of a phase until none is left */
+static void
+sort_phase_run(struct sort_phase *phase)
+{
+    struct sort_task *task;
+    size_t i;
+
+    while ((i = __atomic_fetch_add(&phase->next, 1, __ATOMIC_RELAXED))
+           < phase->n_tasks) {
+        task = &phase->tasks[i];
+        if (task->b == NULL) {
+            qsort(task->a, task->a_n, sizeof *task->a, phase->cmp);
+        }
+        else {
+            sort_merge(task, phase->cmp);
+        }
+    }
+}
+
+/* Worker threads of one ops_sort_parallel call, which hands them each
+ * phase in turn and works on it alongside them */
+struct sort_pool {
+    pthread_mutex_t mutex;
+    pthread_cond_t start;              /* Signalled when a phase is posted */
+    pthread_cond_t done;               /* Signalled by the last worker done */
+    struct sort_phase *phase;          /* Posted phase, NULL to exit */
+    unsigned int generation;           /* Number of phases posted */
+    unsigned int n_running;            /* Workers still in the phase */
+    unsigned int n_threads;            /* Workers started */
+    pthread_t threads[OPS_SORT_PARALLEL_MAX_THREADS];
+};
+
+static void *
+sort_worker(void *pool_)
+{
+    struct sort_pool *pool = pool_;
+    struct sort_phase *phase;
+    unsigned int generation = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&pool->mutex);
+        while (pool->generation == generation) {
+            pthread_cond_wait(&pool->start, &pool->mutex);
+        }
+        generation = pool->generation;
+        phase = pool->phase;
+        pthread_mutex_unlock(&pool->mutex);
+        if (phase == NULL) {
+            return NULL;
+        }
+
+        sort_phase_run(phase);
+
+        pthread_mutex_lock(&pool->mutex);
+        if (--pool->n_running == 0) {
+            pthread_cond_signal(&pool->done);
+        }
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
+
+/* Starts up to n_threads - 1 workers. If a thread cannot be created the
+ * others, and the caller, pick up its share. */
+static void
+sort_pool_init(struct sort_pool *pool, unsigned int n_threads)
+{
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+    pool->phase = NULL;
+    pool->generation = 0;
+    pool->n_running = 0;
+    for (pool->n_threads = 0; pool->n_threads + 1 < n_threads;
+         pool->n_threads++) {
+        if (pthread_create(&pool->threads[pool->n_threads], NULL,
+                           sort_worker, pool)) {
+            break;
+        }
+    }
+}
+
+/* Posts a phase to the workers, or NULL to make them exit */
+static void
+sort_pool_post(struct sort_pool *pool, struct sort_phase *phase)
+{
+    pthread_mutex_lock(&pool->mutex);
+    pool->phase = phase;
+    pool->generation++;
+    pool->n_running = pool->n_threads;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+/* Runs a phase on the workers and the caller, returning once all are done */
+static void
+sort_pool_run(struct sort_pool *pool, struct sort_phase *phase)
+{
+    phase->next = 0;
+    sort_pool_post(pool, phase);
+    sort_phase_run(phase);
+
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->n_running > 0) {
+        pthread_cond_wait(&pool->done, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+static void
+sort_pool_destroy(struct sort_pool *pool)
+{
+    unsigned int i;
+
+    sort_pool_post(pool, NULL);
+    for (i = 0; i < pool->n_threads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->mutex);
+}
+
+/*
+ * Returns how many of the first d merged nodes come from a, so that a
+ * merge can be cut at output position d and both halves done separately.
+ */
+static size_t
+sort_merge_path(const struct shash_node **a, size_t a_n,
+                const struct shash_node **b, size_t b_n, size_t d,
+                sort_cmp_func *cmp)
+{
+    size_t low = d > b_n ? d - b_n : 0;
+    size_t high = MIN(d, a_n);
+    size_t i;
+
+    /* Find the smallest i with a[i] after b[d - i - 1] */
+    while (low < high) {
+        i = low + (high - low) / 2;
+        if (cmp(&b[d - i - 1], &a[i]) < 0) {
+            high = i;
+        }
+        else {
+            low = i + 1;
+        }
+    }
+    return low;
+}
+
+/* Adds tasks merging a and b into out, cut in n_parts along the merge path */
+static void
+sort_add_merge(struct sort_phase *phase, const struct shash_node **a,
+               size_t a_n, const struct shash_node **b, size_t b_n,
+               const struct shash_node **out, size_t n_parts,
+               sort_cmp_func *cmp)
+{
+    size_t total = a_n + b_n;
+    size_t part, d, prev_d = 0, i, prev_i = 0;
+    struct sort_task *task;
+
+    for (part = 1; part <= n_parts; part++) {
+        d = total * part / n_parts;
+        i = (part == n_parts) ? a_n : sort_merge_path(a, a_n, b, b_n, d, cmp);
+        task = &phase->tasks[phase->n_tasks++];
+        task->a = a + prev_i;
+        task->a_n = i - prev_i;
+        task->b = b + (prev_d - prev_i);
+        task->b_n = (d - i) - (prev_d - prev_i);
+        task->out = out + prev_d;
+        prev_d = d;
+        prev_i = i;
+    }
+}
+
+int
+ops_sort_parallel(const struct shash *sh, void *ptr_func_sort,
+                  const struct shash_node **sorted_list,
+                  unsigned int n_threads)
+{
+    sort_cmp_func *cmp = (sort_cmp_func *) ptr_func_sort;
+    size_t bounds[OPS_SORT_PARALLEL_MAX_THREADS + 1];
+    const struct shash_node **src, **dst, **tmp;
+    struct sort_phase phase;
+    struct sort_pool pool;
+    struct shash_node *node;
+    size_t n, i, n_runs, n_parts, r;
+    long n_cpus;
+
+    if ((cmp == NULL) || (sorted_list == NULL) || shash_is_empty(sh)) {
+        return 1;
+    }
+
+    if (n_threads == 0) {
+        n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        n_threads = n_cpus > 0 ? n_cpus : 1;
+    }
+    n_threads = MIN(n_threads, OPS_SORT_PARALLEL_MAX_THREADS);
+
+    n = shash_count(sh);
+    if ((n < OPS_SORT_PARALLEL_MIN) || (n_threads < 2)) {
+        return ops_sort(sh, ptr_func_sort, sorted_list);
+    }
+
+    i = 0;
+    SHASH_FOR_EACH (node, sh) {
+        sorted_list[i++] = node;
+    }
+    ovs_assert(i == n);
+
+    /* Sort one chunk per thread */
+    sort_pool_init(&pool, n_threads);
+    phase.cmp = cmp;
+    /* A merge round has at most n_threads parts plus an odd run out */
+    phase.tasks = xmalloc((n_threads + 1) * sizeof *phase.tasks);
+    phase.n_tasks = 0;
+    n_runs = n_threads;
+    for (r = 0; r <= n_runs; r++) {
+        bounds[r] = n * r / n_runs;
+    }
+    for (r = 0; r < n_runs; r++) {
+        phase.tasks[phase.n_tasks++] = (struct sort_task) {
+            .a = sorted_list + bounds[r],
+            .a_n = bounds[r + 1] - bounds[r],
+        };
+    }
+    sort_pool_run(&pool, &phase);
+
+    /* Merge runs pairwise until one is left, alternating buffers */
+    tmp = xmalloc(n * sizeof *tmp);
+    src = sorted_list;
+    dst = tmp;
+    while (n_runs > 1) {
+        phase.n_tasks = 0;
+        n_parts = MAX(1, n_threads / (n_runs / 2));
+        for (r = 0; r + 1 < n_runs; r += 2) {
+            sort_add_merge(&phase, src + bounds[r], bounds[r + 1] - bounds[r],
+                           src + bounds[r + 1],
+                           bounds[r + 2] - bounds[r + 1],
+                           dst + bounds[r], n_parts, cmp);
+        }
+        if (n_runs % 2) {
+            /* An odd run out is carried over as a merge with nothing */
+            phase.tasks[phase.n_tasks++] = (struct sort_task) {
+                .a = src + bounds[n_runs - 1],
+                .a_n = bounds[n_runs] - bounds[n_runs - 1],
+                .b = src + bounds[n_runs],
+                .b_n = 0,
+                .out = dst + bounds[n_runs - 1],
+            };
+        }
+        sort_pool_run(&pool, &phase);
+
+        for (r = 0; 2 * r < n_runs; r++) {
+            bounds[r] = bounds[2 * r];
+        }
+        bounds[r] = n;
+        n_runs = r;
+        tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+
+    sort_pool_destroy(&pool);
+
+    if (src != sorted_list) {
+        memcpy(sorted_list, src, n * sizeof *sorted_list);
+        free(src);
+    }
+    else {
+        free(dst);
+    }
+    free(phase.tasks);
+    return 0;
+}
+
+/*****************************************************************************
+ *                          Sorted view                                      *
+ *****************************************************************************/
+
+/* Returns the first position whose node does not compare below node */
+static size_t
+sorted_view_lower_bound(const struct ops_sorted_view *view,
+                        const struct shash_node *node)
+{
+    sort_cmp_func *cmp = (sort_cmp_func *) view->ptr_func_sort;
+    size_t low = 0, high = view->n, mid;
+
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        if (cmp(&view->nodes[mid], &node) < 0) {
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+void
+ops_sorted_view_init(struct ops_sorted_view *view, const struct shash *sh,
+                     void *ptr_func_sort)
+{
+    memset(view, 0, sizeof *view);
+    view->sh = sh;
+    view->ptr_func_sort = ptr_func_sort;
+    view->dirty = true;
+}
+
+void
+ops_sorted_view_destroy(struct ops_sorted_view *view)
+{
+    free(view->nodes);
+    memset(view, 0, sizeof *view);
+}
+
+void
+ops_sorted_view_invalidate(struct ops_sorted_view *view)
+{
+    view->dirty = true;
+}
+
+void
+ops_sorted_view_set_seqno(struct ops_sorted_view *view, unsigned int seqno)
+{
+    if (view->seqno != seqno) {
+        view->seqno = seqno;
+        view->dirty = true;
+    }
+}
+
+void
+ops_sorted_view_insert(struct ops_sorted_view *view,
+                       const struct shash_node *node)
+{
+    size_t pos;
+
+    if (view->dirty) {
+        return;
+    }
+    if (view->n == view->allocated) {
+        view->nodes = x2nrealloc(view->nodes, &view->allocated,
+                                 sizeof *view->nodes);
+    }
+    pos = sorted_view_lower_bound(view, node);
+    memmove(&view->nodes[pos + 1], &view->nodes[pos],
+            (view->n - pos) * sizeof *view->nodes);
+    view->nodes[pos] = node;
+    view->n++;
+}
+
+bool
+ops_sorted_view_remove(struct ops_sorted_view *view,
+                       const struct shash_node *node)
+{
+    sort_cmp_func *cmp = (sort_cmp_func *) view->ptr_func_sort;
+    size_t pos;
+
+    if (view->dirty) {
+        return true;
+    }
+
+    /* Nodes comparing equal may be in any order, look through all */
+    for (pos = sorted_view_lower_bound(view, node);
+         (pos < view->n) && !cmp(&view->nodes[pos], &node); pos++) {
+        if (view->nodes[pos] == node) {
+            memmove(&view->nodes[pos], &view->nodes[pos + 1],
+                    (view->n - pos - 1) * sizeof *view->nodes);
+            view->n--;
+            return true;
+        }
+    }
+    return false;
+}
+
+const struct shash_node **
+ops_sorted_view_get(struct ops_sorted_view *view, size_t *n)
+{
+    size_t count;
+
+    if (view->dirty) {
+        count = shash_count(view->sh);
+        if (count > view->allocated) {
+            view->allocated = count;
+            view->nodes = xrealloc(view->nodes,
+                                   count * sizeof *view->nodes);
+        }
+        view->n = count;
+        if (count) {
+            ops_sort(view->sh, view->ptr_func_sort, view->nodes);
+        }
+        view->dirty = false;
+    }
+
+    *n = view->n;
+    return view->nodes;
+}
@@ -0,0 +1,408 @@
+/*
+ Copyright (C) 2016 Hewlett-Packard Development Company, L.P.
+ All Rights Reserved.
+
+    Licensed under the Apache License, Version 2.0 (the "License"); you may
+    not use this file except in compliance with the License. You may obtain
+    a copy of the License at
+
+         http://www.apache.org/licenses/LICENSE-2.0
+
+    Unless required by applicable law or agreed to in writing, software
+    distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+    WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+    License for the specific language governing permissions and limitations
+    under the License.
+*/
+
+/*************************************************************************//**
+ * @ingroup vlan_bitmap
+ * This module contains the DEFINES and functions that comprise the
+ * vlan-bitmap library.
+ *
+ * @file
+ * Source file for vlan-bitmap library.
+ *
+ ****************************************************************************/
+
+#include <string.h>
+
+#include "vlan-bitmap.h"
+
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#define VLAN_BITMAP_X86 1
+#endif
+
+/* Mask of the bits at and above bit in a word */
+#define VLAN_BITMAP_MASK_FROM(BIT)  (UINT64_MAX << (BIT))
+
+/*
+ * Word-wise set operations. Each has a portable kernel and, on x86-64, an
+ * SSE2 kernel (always available there) and an AVX2 kernel picked at run
+ * time if the CPU supports it.
+ */
+enum vlan_bitmap_op {
+    VLAN_BITMAP_AND,
+    VLAN_BITMAP_OR,
+    VLAN_BITMAP_ANDNOT                 /* a & ~b */
+};
+
+typedef void vlan_bitmap_op_func(uint64_t *dst, const uint64_t *a,
+                                 const uint64_t *b, enum vlan_bitmap_op op);
+typedef size_t vlan_bitmap_count_func(const uint64_t *words);
+
+static void
+vlan_bitmap_op_generic(uint64_t *dst, const uint64_t *a, const uint64_t *b,
+                       enum vlan_bitmap_op op)
+{
+    int i;
+
+    switch (op) {
+    case VLAN_BITMAP_AND:
+        for (i = 0; i < OPS_VLAN_BITMAP_WORDS; i++) {
+            dst[i] = a[i] & b[i];
+        }
+        break;
+    case VLAN_BITMAP_OR:
+        for (i = 0; i < OPS_VLAN_BITMAP_WORDS; i++) {
+            dst[i] = a[i] | b[i];
+        }
+        break;
+    case VLAN_BITMAP_ANDNOT:
+        for (i = 0; i < OPS_VLAN_BITMAP_WORDS; i++) {
+            dst[i] = a[i] & ~b[i];
+        }
+        break;
+    }
+}
+
+static size_t
+vlan_bitmap_count_generic(const uint64_t *words)
+{
+    size_t count = 0;
+    int i;
+
+    for (i = 0; i < OPS_VLAN_BITMAP_WORDS; i++) {
+        count += __builtin_popcountll(words[i]);
+    }
+    return count;
+}
+
+#ifdef VLAN_BITMAP_X86
+static void
+vlan_bitmap_op_sse2(uint64_t *dst, const uint64_t *a, const uint64_t *b,
+                    enum vlan_bitmap_op op)
+{
+    __m128i x, y;
+    int i;
+
+    for (i = 0; i < OPS_VLAN_BITMAP_WORDS; i += 2) {
+        x = _mm_loadu_si128((const __m128i *) &a[i]);
+        y = _mm_loadu_si128((const __m128i *) &b[i]);
+        switch (op) {
+        case VLAN_BITMAP_AND:
+            x = _mm_and_si128(x, y);
+            break;
+        case VLAN_BITMAP_OR:
+            x = _mm_or_si128(x, y);
+            break;
+        case VLAN_BITMAP_ANDNOT:
+            x = _mm_andnot_si128(y, x);
+            break;
+        }
+        _mm_storeu_si128((__m128i *) &dst[i], x);
+    }
+}
+
+__attribute__((target("avx2")))
+static void
+vlan_bitmap_op_avx2(uint64_t *dst, const uint64_t *a, const uint64_t *b,
+                    enum vlan_bitmap_op op)
+{
+    __m256i x, y;
+    int i;
+
+    for (i = 0; i < OPS_VLAN_BITMAP_WORDS; i += 4) {
+        x = _mm256_loadu_si256((const __m256i *) &a[i]);
+        y = _mm256_loadu_si256((const __m256i *) &b[i]);
+        switch (op) {
+        case VLAN_BITMAP_AND:
+            x = _mm256_and_si256(x, y);
+            break;
+        case VLAN_BITMAP_OR:
+            x = _mm256_or_si256(x, y);
+            break;
+        case VLAN_BITMAP_ANDNOT:
+            x = _mm256_andnot_si256(y, x);
+            break;
+        }
+        _mm256_storeu_si256((__m256i *) &dst[i], x);
+    }
+}
+
+/* Same as the generic kernel, but compiled to the POPCNT instruction
+ * instead of a libgcc call */
+__attribute__((target("popcnt")))
+static size_t
+vlan_bitmap_count_popcnt(const uint64_t *words)
+{
+    size_t count = 0;
+    int i;
+
+    for (i = 0; i < OPS_VLAN_BITMAP_WORDS; i++) {
+        count += __builtin_popcountll(words[i]);
+    }
+    return count;
+}
+#endif /* VLAN_BITMAP_X86 */
+
+static vlan_bitmap_op_func *vlan_bitmap_op;
+static vlan_bitmap_count_func *vlan_bitmap_count;
+
+/* Picks the kernels for this CPU. Racing callers store the same values. */
+static void
+vlan_bitmap_select_kernels(void)
+{
+    vlan_bitmap_op_func *op = vlan_bitmap_op_generic;
+    vlan_bitmap_count_func *count = vlan_bitmap_count_generic;
+
+#ifdef VLAN_BITMAP_X86
+    __builtin_cpu_init();
+    op = __builtin_cpu_supports("avx2") ? vlan_bitmap_op_avx2
+                                        : vlan_bitmap_op_sse2;
+    if (__builtin_cpu_supports("popcnt")) {
+        count = vlan_bitmap_count_popcnt;
+    }
+#endif
+    vlan_bitmap_count = count;
+    vlan_bitmap_op = op;
+}
+
+static inline void
+vlan_bitmap_apply(struct ops_vlan_bitmap *dst, const struct ops_vlan_bitmap *a,
+                  const struct ops_vlan_bitmap *b, enum vlan_bitmap_op op)
+{
+    if (vlan_bitmap_op == NULL) {
+        vlan_bitmap_select_kernels();
+    }
+    vlan_bitmap_op(dst->words, a->words, b->words, op);
+}
+
+void
+ops_vlan_bitmap_init(struct ops_vlan_bitmap *bitmap)
+{
+    memset(bitmap, 0, sizeof *bitmap);
+}
+
+void
+ops_vlan_bitmap_set_range(struct ops_vlan_bitmap *bitmap, unsigned int first,
+                          unsigned int last)
+{
+    unsigned int first_word = first / 64;
+    unsigned int last_word = last / 64;
+    uint64_t first_mask = VLAN_BITMAP_MASK_FROM(first % 64);
+    uint64_t last_mask = UINT64_MAX >> (63 - last % 64);
+    unsigned int i;
+
+    if (first > last) {
+        return;
+    }
+    if (first_word == last_word) {
+        bitmap->words[first_word] |= first_mask & last_mask;
+        return;
+    }
+    bitmap->words[first_word] |= first_mask;
+    for (i = first_word + 1; i < last_word; i++) {
+        bitmap->words[i] = UINT64_MAX;
+    }
+    bitmap->words[last_word] |= last_mask;
+}
+
+/*
+ * Parses a decimal VLAN id at *p and advances *p past it. Returns false if
+ * there is no number or it is out of range.
+ */
+static bool
+vlan_bitmap_parse_vid(const char **p, unsigned int *vid)
+{
+    const char *s = *p;
+    unsigned int val = 0;
+
+    if (*s < '0' || *s > '9') {
+        return false;
+    }
+    while (*s >= '0' && *s <= '9') {
+        val = val * 10 + (*s++ - '0');
+        if (val > OPS_VLAN_ID_MAX) {
+            return false;
+        }
+    }
+    if (val < OPS_VLAN_ID_MIN) {
+        return false;
+    }
+    *vid = val;
+    *p = s;
+    return true;
+}
+
+bool
+ops_vlan_bitmap_parse(struct ops_vlan_bitmap *bitmap, const char *str)
+{
+    const char *p = str;
+    unsigned int first, last;
+
+    ops_vlan_bitmap_init(bitmap);
+    for (;;) {
+        while (*p == ' ') {
+            p++;
+        }
+        if (!vlan_bitmap_parse_vid(&p, &first)) {
+            return false;
+        }
+        last = first;
+        if (*p == '-') {
+            p++;
+            if (!vlan_bitmap_parse_vid(&p, &last) || last < first) {
+                return false;
+            }
+        }
+        ops_vlan_bitmap_set_range(bitmap, first, last);
+
+        while (*p == ' ') {
+            p++;
+        }
+        if (*p == '\0') {
+            return true;
+        }
+        if (*p++ != ',') {
+            return false;
+        }
+    }
+}
+
+void
+ops_vlan_bitmap_union(struct ops_vlan_bitmap *dst,
+                      const struct ops_vlan_bitmap *a,
+                      const struct ops_vlan_bitmap *b)
+{
+    vlan_bitmap_apply(dst, a, b, VLAN_BITMAP_OR);
+}
+
+void
+ops_vlan_bitmap_intersect(struct ops_vlan_bitmap *dst,
+                          const struct ops_vlan_bitmap *a,
+                          const struct ops_vlan_bitmap *b)
+{
+    vlan_bitmap_apply(dst, a, b, VLAN_BITMAP_AND);
+}
+
+void
+ops_vlan_bitmap_difference(struct ops_vlan_bitmap *dst,
+                           const struct ops_vlan_bitmap *a,
+                           const struct ops_vlan_bitmap *b)
+{
+    vlan_bitmap_apply(dst, a, b, VLAN_BITMAP_ANDNOT);
+}
+
+void
+ops_vlan_bitmap_union_many(struct ops_vlan_bitmap *dst,
+                           const struct ops_vlan_bitmap *const *bitmaps,
+                           size_t n)
+{
+    struct ops_vlan_bitmap result;
+    size_t i;
+
+    if (n == 0) {
+        ops_vlan_bitmap_init(dst);
+        return;
+    }
+    /* dst may be any of the inputs, so it is only written at the end */
+    result = *bitmaps[0];
+    for (i = 1; i < n; i++) {
+        vlan_bitmap_apply(&result, &result, bitmaps[i], VLAN_BITMAP_OR);
+    }
+    *dst = result;
+}
+
+void
+ops_vlan_bitmap_intersect_many(struct ops_vlan_bitmap *dst,
+                               const struct ops_vlan_bitmap *const *bitmaps,
+                               size_t n)
+{
+    struct ops_vlan_bitmap result;
+    size_t i;
+
+    if (n == 0) {
+        ops_vlan_bitmap_init(dst);
+        return;
+    }
+    /* dst may be any of the inputs, so it is only written at the end */
+    result = *bitmaps[0];
+    for (i = 1; i < n; i++) {
+        vlan_bitmap_apply(&result, &result, bitmaps[i], VLAN_BITMAP_AND);
+    }
+    *dst = result;
+}
+
+bool
+ops_vlan_bitmap_equal(const struct ops_vlan_bitmap *a,
+                      const struct ops_vlan_bitmap *b)
+{
+    return !memcmp(a, b, sizeof *a);
+}
+
+bool
+ops_vlan_bitmap_is_empty(const struct ops_vlan_bitmap *bitmap)
+{
+    uint64_t bits = 0;
+    int i;
+
+    for (i = 0; i < OPS_VLAN_BITMAP_WORDS; i++) {
+        bits |= bitmap->words[i];
+    }
+    return bits == 0;
+}
+
+size_t
+ops_vlan_bitmap_count(const struct ops_vlan_bitmap *bitmap)
+{
+    if (vlan_bitmap_count == NULL) {
+        vlan_bitmap_select_kernels();
+    }
+    return vlan_bitmap_count(bitmap->words);
+}
+
+size_t
+ops_vlan_bitmap_to_array(const struct ops_vlan_bitmap *bitmap, int64_t *ids)
+{
+    size_t n = 0;
+    uint64_t word;
+    int i;
+
+    for (i = 0; i < OPS_VLAN_BITMAP_WORDS; i++) {
+        for (word = bitmap->words[i]; word; word &= word - 1) {
+            ids[n++] = i * 64 + __builtin_ctzll(word);
+        }
+    }
+    return n;
+}
+
+unsigned int
+ops_vlan_bitmap_next(const struct ops_vlan_bitmap *bitmap, unsigned int start)
+{
+    unsigned int i = start / 64;
+    uint64_t word;
+
+    if (start >= OPS_VLAN_ID_COUNT) {
+        return OPS_VLAN_ID_COUNT;
+    }
+    word = bitmap->words[i] & VLAN_BITMAP_MASK_FROM(start % 64);
+    while (!word) {
+        if (++i >= OPS_VLAN_BITMAP_WORDS) {
+            return OPS_VLAN_ID_COUNT;
+        }
+        word = bitmap->words[i];
+    }
+    return i * 64 + __builtin_ctzll(word);
+}